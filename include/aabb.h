@@ -11,11 +11,11 @@ class aabb
   {
     // Adjust the AABB so that no side is narrower than some delta, padding if
     // necessary
-    double delta = 0.0001;
+    real delta = 0.0001;
 
     if (x.size() < delta) x = x.expand(delta);
-    if (y.size() < delta) x = y.expand(delta);
-    if (z.size() < delta) x = z.expand(delta);
+    if (y.size() < delta) y = y.expand(delta);
+    if (z.size() < delta) z = z.expand(delta);
   }
 
  public:
@@ -35,6 +35,8 @@ class aabb
     x = a[0] <= b[0] ? interval(a[0], b[0]) : interval(b[0], a[0]);
     y = a[1] <= b[1] ? interval(a[1], b[1]) : interval(b[1], a[1]);
     z = a[2] <= b[2] ? interval(a[2], b[2]) : interval(b[2], a[2]);
+
+    pad_to_minimum();
   }
 
   aabb(const aabb& bbox0, const aabb& bbox1)
@@ -59,7 +61,7 @@ class aabb
     for (int axis = 0; axis < 3; axis++)
     {
       const interval& ax = axis_interval(axis);
-      const double adinv = 1.0 / ray_dir[axis];
+      const real adinv = 1.0 / ray_dir[axis];
 
       auto t0 = (ax.min - ray_orig[axis]) * adinv;
       auto t1 = (ax.max - ray_orig[axis]) * adinv;
@@ -0,0 +1,115 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+#include "framebuffer.h"
+
+// Arbitrary output variables: images of what the camera rays found, written
+// alongside the color from the same paths. Each one is enabled by its bit in
+// a mask, and only enabled ones are gathered and stored.
+enum aov : uint32_t
+{
+  aov_depth = 1 << 0,         // Distance along the camera ray to the first hit
+  aov_normal = 1 << 1,        // Shading normal, facing the camera
+  aov_albedo = 1 << 2,        // Reflectance of the first hit's material
+  aov_material_id = 1 << 3,   // Index into material_table
+  aov_primitive_id = 1 << 4,  // hit_record::prim_id
+  aov_cost = 1 << 5,          // Rays traced for the pixel, as a heatmap
+
+  aov_count = 6  // Number of outputs, not a flag
+};
+
+inline const char* aov_name(int index)
+{
+  static const char* names[aov_count] = {"depth",       "normal",
+                                         "albedo",      "material_id",
+                                         "primitive_id", "cost"};
+  return names[index];
+}
+
+struct pixel_aovs
+{
+  // The outputs of one pixel, summed over its samples. Rays that leave the
+  // scene count the background as albedo, with no normal and a depth of 0.
+  // IDs cannot be averaged, so they are those of the pixel's first sample,
+  // or -1 if it hit nothing.
+  int samples = 0;
+  color albedo = color(0, 0, 0);
+  vec3 normal = vec3(0, 0, 0);
+  double depth = 0;
+  double material_id = -1;
+  double primitive_id = -1;
+  int64_t rays = 0;
+};
+
+class aov_buffers
+{
+ private:
+  uint32_t mask;
+  framebuffer images[aov_count];  // Empty unless enabled
+
+ public:
+  aov_buffers(int width, int height, uint32_t mask) : mask(mask)
+  {
+    for (int k = 0; k < int(aov_count); k++)
+      if (mask & (1u << k)) images[k] = framebuffer(width, height);
+  }
+
+  const framebuffer& get(aov a) const { return images[index(a)]; }
+  framebuffer& get(aov a) { return images[index(a)]; }
+
+  // Stores a pixel's outputs, averaging the summed ones with `scale`, the
+  // reciprocal of its sample count. Cost is stored in rays, and scaled to
+  // the image's maximum by normalize_cost() once every pixel is done.
+  void set(int x, int y, const pixel_aovs& sum, double scale)
+  {
+    auto grey = [](double v) { return color(v, v, v); };
+    if (mask & aov_depth) get(aov_depth).set(x, y, grey(scale * sum.depth));
+    if (mask & aov_normal) get(aov_normal).set(x, y, scale * sum.normal);
+    if (mask & aov_albedo) get(aov_albedo).set(x, y, scale * sum.albedo);
+    if (mask & aov_material_id)
+      get(aov_material_id).set(x, y, grey(sum.material_id));
+    if (mask & aov_primitive_id)
+      get(aov_primitive_id).set(x, y, grey(sum.primitive_id));
+    if (mask & aov_cost) get(aov_cost).set(x, y, grey(double(sum.rays)));
+  }
+
+  // Scales the cost image so the most expensive pixel is white, and returns
+  // that pixel's ray count.
+  double normalize_cost()
+  {
+    if (!(mask & aov_cost)) return 0;
+
+    auto& cost = get(aov_cost);
+    double most = 1;
+    for (int y = 0; y < cost.height(); y++)
+      for (int x = 0; x < cost.width(); x++)
+        most = std::fmax(most, cost.at(x, y).x());
+    for (int y = 0; y < cost.height(); y++)
+      for (int x = 0; x < cost.width(); x++)
+        cost.set(x, y, cost.at(x, y) / most);
+    return most;
+  }
+
+  template <typename Fn>
+  void for_each(Fn fn) const
+  {
+    // Calls fn(output, name, image) for every enabled output.
+    for (int k = 0; k < int(aov_count); k++)
+      if (mask & (1u << k))
+        fn(aov(1u << k), std::string(aov_name(k)), images[k]);
+  }
+
+ private:
+  static int index(aov a)
+  {
+    int k = 0;
+    while (!(uint32_t(a) & (1u << k))) k++;
+    return k;
+  }
+};
+
+#endif
@@ -2,8 +2,10 @@
 #define BVH_H
 
 #include <algorithm>
+#include <chrono>
 
 #include "aabb.h"
+#include "bvh_builder.h"
 #include "hittable_list.h"
 
 class bvh_node : public hittable
@@ -14,89 +16,121 @@ class bvh_node : public hittable
   aabb bbox;
 
  public:
-  bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size())
+  bvh_node(const hittable_list& list,
+           bvh_build_options options = bvh_build_options(),
+           bvh_build_stats* stats = nullptr)
   {
-    // There's a C++ subtlety here. This constructor (without span indices)
-    // creates an implicit copy of the hittable list, which we will modify. The
-    // lifetime of the copied list only extends until this constructor exits.
-    // That's OK, because we only need to persist the BVH
-  }
+    // Builds the tree over an index array of primitive bounds, so the source
+    // list is neither copied nor reordered. If `stats` is given, it receives
+    // the build time and the SAH cost of the resulting tree.
 
-  bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end)
-  {
-    // Build the bounding box of the span of source objects
-    bbox = aabb::empty;
-    for (size_t object_index = start; object_index < end; object_index++)
-    {
-      bbox = aabb(bbox, objects[object_index]->bounding_box());
-    }
+    auto start_time = std::chrono::steady_clock::now();
 
-    int axis = bbox.longest_axis();
+    // Nodes hold at most two children, so every larger range must split.
+    options.max_leaf_size = std::min(options.max_leaf_size, 2);
+    bvh_builder builder(options);
 
-    auto comparator = (axis == 0)   ? box_x_compare
-                      : (axis == 1) ? box_y_compare
-                                    : box_z_compare;
+    auto prims = bvh_builder::make_primitives(list.objects);
+    auto root_bbox = bvh_builder::bounds_of(prims, 0, prims.size());
 
-    size_t object_span = end - start;
+    bvh_build_stats local_stats;
+    auto& s = stats ? *stats : local_stats;
+    s = bvh_build_stats();
+    build(list.objects, prims, 0, prims.size(), 0, builder, root_bbox, s);
 
-    if (object_span == 1)
-    {
-      left = right = objects[start];
-    }
-    else if (object_span == 2)
-    {
-      left = objects[start];
-      right = objects[start + 1];
-    }
-    else
-    {
-      std::sort(std::begin(objects) + start, std::begin(objects) + end,
-                comparator);
+    s.build_ms = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start_time)
+                     .count();
+  }
 
-      auto mid = start + object_span / 2;
-      left = make_shared<bvh_node>(objects, start, mid);
-      right = make_shared<bvh_node>(objects, mid, end);
-    }
+  bvh_node(const std::vector<shared_ptr<hittable>>& objects,
+           std::vector<bvh_primitive>& prims, size_t start, size_t end,
+           int depth, const bvh_builder& builder, const aabb& root_bbox,
+           bvh_build_stats& stats)
+  {
+    build(objects, prims, start, end, depth, builder, root_bbox, stats);
   }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
   {
     if (!bbox.hit(r, ray_t)) return false;
 
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right =
-        right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    bool hit_left = left->intersect(r, ray_t, hit);
+    bool hit_right = right->intersect(
+        r, interval(ray_t.min, hit_left ? hit.t : ray_t.max), hit);
 
     return hit_left || hit_right;
   }
 
-  aabb bounding_box() const override { return bbox; }
-
- private:
-  static bool box_compare(const shared_ptr<hittable> a,
-                          const shared_ptr<hittable> b, int axis_index)
+  void intersect_packet(ray_packet& packet, uint32_t mask) const override
   {
-    auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-    auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-    return a_axis_interval.min < b_axis_interval.min;
+    // Only the lanes that enter this box go on to the children.
+    uint32_t inside = 0;
+    for_each_lane(mask, [&](int k) {
+      if (bbox.hit(packet.get(k), packet.range(k))) inside |= 1u << k;
+    });
+    if (!inside) return;
+
+    left->intersect_packet(packet, inside);
+    if (right != left) right->intersect_packet(packet, inside);
   }
 
-  static bool box_x_compare(const shared_ptr<hittable> a,
-                            const shared_ptr<hittable> b)
+  bool occluded(const ray& r, interval ray_t) const override
   {
-    return box_compare(a, b, 0);
+    return bbox.hit(r, ray_t) &&
+           (left->occluded(r, ray_t) || right->occluded(r, ray_t));
   }
 
-  static bool box_y_compare(const shared_ptr<hittable> a,
-                            const shared_ptr<hittable> b)
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
   {
-    return box_compare(a, b, 1);
+    // Single-primitive leaves point both children at the same object.
+    left->gather_emitters(emitters);
+    if (right != left) right->gather_emitters(emitters);
   }
 
-  static bool box_z_compare(const shared_ptr<hittable> a,
-                            const shared_ptr<hittable> b)
+ private:
+  void build(const std::vector<shared_ptr<hittable>>& objects,
+             std::vector<bvh_primitive>& prims, size_t start, size_t end,
+             int depth, const bvh_builder& builder, const aabb& root_bbox,
+             bvh_build_stats& stats)
   {
-    return box_compare(a, b, 2);
+    bbox = bvh_builder::bounds_of(prims, start, end);
+
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    auto weight = bvh_builder::relative_area(bbox, root_bbox);
+
+    size_t object_span = end - start;
+
+    if (object_span == 1)
+    {
+      left = right = objects[prims[start].index];
+    }
+    else if (object_span == 2)
+    {
+      left = objects[prims[start].index];
+      right = objects[prims[start + 1].index];
+    }
+    else
+    {
+      int axis;
+      auto mid = builder.split(prims, start, end, bbox, depth, axis);
+
+      left = make_shared<bvh_node>(objects, prims, start, mid, depth + 1,
+                                   builder, root_bbox, stats);
+      right = make_shared<bvh_node>(objects, prims, mid, end, depth + 1,
+                                    builder, root_bbox, stats);
+
+      stats.sah_cost += weight * builder.options.traversal_cost;
+      return;
+    }
+
+    // Both children are primitives, so this node acts as a leaf.
+    stats.leaf_count++;
+    stats.sah_cost += weight * (builder.options.traversal_cost +
+                                builder.leaf_cost(object_span));
   }
 };
 
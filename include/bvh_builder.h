@@ -0,0 +1,323 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "aabb.h"
+#include "hittable.h"
+#include "thread_pool.h"
+
+enum class bvh_split_method
+{
+  sah,    // Binned surface area heuristic
+  median  // Equal counts either side of the centroid median (the old builder)
+};
+
+struct bvh_build_options
+{
+  bvh_split_method split_method = bvh_split_method::sah;
+  int bin_count = 16;             // Centroid bins per axis, at most 64
+  int max_leaf_size = 4;          // Ranges larger than this are always split
+  double traversal_cost = 1.0;     // Cost of visiting an interior node
+  double intersection_cost = 1.0;  // Cost of testing one primitive
+
+  // Threads for building (0 = one per hardware thread). Builders that support
+  // it fork subtrees and split large ranges across a pool; bvh_node always
+  // builds serially.
+  int thread_count = 1;
+};
+
+struct bvh_build_stats
+{
+  size_t node_count = 0;
+  size_t leaf_count = 0;
+  int max_depth = 0;
+  double sah_cost = 0;  // Expected cost of a random ray, from the cost model
+  double build_ms = 0;
+
+  friend std::ostream& operator<<(std::ostream& out, const bvh_build_stats& s)
+  {
+    return out << "BVH: " << s.node_count << " nodes, " << s.leaf_count
+               << " leaves, depth " << s.max_depth << ", SAH cost "
+               << s.sah_cost << ", built in " << s.build_ms << " ms";
+  }
+};
+
+struct bvh_primitive
+{
+  aabb bbox;
+  point3 centroid;
+  uint32_t index;  // Position of the primitive in the source list
+};
+
+class bvh_builder
+{
+  // Split selection shared by the BVH implementations. The builders own their
+  // node layout; this class only decides how to partition a range of
+  // primitives, in place and in time linear in the range size, so a whole
+  // build is O(n log n).
+
+ private:
+  // Below this depth splits follow the SAH. Deeper ranges, which only arise
+  // from pathological inputs, are split by count, which caps the total depth
+  // at 32 + log2(n) and keeps fixed-size traversal stacks safe.
+  static const int max_sah_depth = 32;
+
+  static constexpr int max_bins = 64;
+
+  struct bin
+  {
+    aabb bbox;
+    int count = 0;
+  };
+  using bin_array = std::array<bin, 3 * max_bins>;
+
+  // Ranges shorter than this are processed serially even when a pool is
+  // available; below it, the fork overhead outweighs the work.
+  static const size_t parallel_grain = 1 << 14;
+
+  template <typename Map, typename Combine>
+  static auto reduce(size_t start, size_t end, thread_pool* pool, Map map,
+                     Combine combine)
+  {
+    // Applies map to chunks of [start, end) and folds the chunk results
+    // together with combine, in parallel on the pool for large ranges.
+    size_t count = end - start;
+    if (!pool || pool->size() == 1 || count < 2 * parallel_grain)
+      return map(start, end);
+
+    auto chunks =
+        int(std::min(count / parallel_grain, size_t(4 * pool->size())));
+    std::vector<decltype(map(start, end))> results(chunks);
+    pool->parallel_for(chunks, [&](int c, int) {
+      results[c] = map(start + count * c / chunks,
+                       start + count * (c + 1) / chunks);
+    });
+
+    for (int c = 1; c < chunks; c++) combine(results[0], results[c]);
+    return results[0];
+  }
+
+  static double area(const aabb& box)
+  {
+    auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+    if (dx < 0 || dy < 0 || dz < 0) return 0;  // Empty box
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
+ public:
+  bvh_build_options options;
+
+  bvh_builder(const bvh_build_options& options = bvh_build_options())
+      : options(options)
+  {
+  }
+
+  static std::vector<bvh_primitive> make_primitives(
+      const std::vector<shared_ptr<hittable>>& objects,
+      thread_pool* pool = nullptr)
+  {
+    std::vector<bvh_primitive> prims(objects.size());
+    reduce(0, objects.size(), pool,
+           [&](size_t first, size_t last) {
+             for (size_t i = first; i < last; i++)
+             {
+               auto box = objects[i]->bounding_box();
+               prims[i].bbox = box;
+               prims[i].centroid = point3(0.5 * (box.x.min + box.x.max),
+                                          0.5 * (box.y.min + box.y.max),
+                                          0.5 * (box.z.min + box.z.max));
+               prims[i].index = uint32_t(i);
+             }
+             return 0;
+           },
+           [](int&, int) {});
+    return prims;
+  }
+
+  static aabb bounds_of(const std::vector<bvh_primitive>& prims, size_t start,
+                        size_t end, thread_pool* pool = nullptr)
+  {
+    return reduce(
+        start, end, pool,
+        [&](size_t first, size_t last) {
+          aabb bounds = aabb::empty;
+          for (size_t i = first; i < last; i++)
+            bounds = aabb(bounds, prims[i].bbox);
+          return bounds;
+        },
+        [](aabb& into, const aabb& from) { into = aabb(into, from); });
+  }
+
+  double leaf_cost(size_t count) const
+  {
+    return options.intersection_cost * double(count);
+  }
+
+  static double relative_area(const aabb& box, const aabb& root)
+  {
+    // Probability that a random ray hitting the root also hits the box.
+    auto root_area = area(root);
+    return root_area > 0 ? area(box) / root_area : 1;
+  }
+
+  size_t split(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+               const aabb& bounds, int depth, int& axis,
+               thread_pool* pool = nullptr) const
+  {
+    // Partitions prims[start, end) and returns the first index of the second
+    // half, with `axis` set to the split axis. Returns `start` if the range is
+    // better off as a single leaf under the cost model. Given a pool, the
+    // passes over large ranges are spread across its workers.
+
+    size_t count = end - start;
+
+    // Centroid extents are kept as bare intervals: an aabb would pad flat
+    // extents, making coincident centroids look separable.
+    using extents = std::array<interval, 3>;
+    auto centroid_extent = reduce(
+        start, end, pool,
+        [&](size_t first, size_t last) {
+          extents e;
+          for (size_t i = first; i < last; i++)
+            for (int a = 0; a < 3; a++)
+              e[a] = interval(e[a], interval(prims[i].centroid[a],
+                                             prims[i].centroid[a]));
+          return e;
+        },
+        [](extents& into, const extents& from) {
+          for (int a = 0; a < 3; a++) into[a] = interval(into[a], from[a]);
+        });
+
+    axis = 0;
+    for (int a = 1; a < 3; a++)
+      if (centroid_extent[a].size() > centroid_extent[axis].size()) axis = a;
+
+    bool must_split = count > size_t(options.max_leaf_size);
+    if (count <= 1) return start;
+
+    if (options.split_method == bvh_split_method::median ||
+        depth >= max_sah_depth)
+      return must_split ? split_median(prims, start, end, axis) : start;
+
+    // Bin centroids along all three axes in one pass over the range. Bin k of
+    // axis a is bins[a * bin_count + k]. Small ranges use fewer bins: with a
+    // handful of primitives, extra bins are mostly empty but still swept.
+    int bin_count = std::clamp(options.bin_count, 2, max_bins);
+    bin_count = std::min(bin_count, std::max(4, int(count)));
+    double to_bin[3];
+    for (int a = 0; a < 3; a++)
+    {
+      auto size = centroid_extent[a].size();
+      to_bin[a] = size > 0 ? bin_count / size : 0;
+    }
+
+    auto bin_index = [&](const bvh_primitive& p, int a) {
+      auto b = int((p.centroid[a] - centroid_extent[a].min) * to_bin[a]);
+      return std::clamp(b, 0, bin_count - 1);
+    };
+
+    auto bins = reduce(
+        start, end, pool,
+        [&](size_t first, size_t last) {
+          bin_array local;
+          for (size_t i = first; i < last; i++)
+            for (int a = 0; a < 3; a++)
+            {
+              auto& b = local[a * bin_count + bin_index(prims[i], a)];
+              b.count++;
+              b.bbox = aabb(b.bbox, prims[i].bbox);
+            }
+          return local;
+        },
+        [&](bin_array& into, const bin_array& from) {
+          for (int k = 0; k < 3 * bin_count; k++)
+          {
+            into[k].count += from[k].count;
+            into[k].bbox = aabb(into[k].bbox, from[k].bbox);
+          }
+        });
+
+    // Sweep each axis for the cheapest plane.
+    double left_area[max_bins];
+    int left_count[max_bins];
+
+    double best_cost = infinity;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int a = 0; a < 3; a++)
+    {
+      if (to_bin[a] == 0) continue;
+      const bin* axis_bins = &bins[a * bin_count];
+
+      // left_*[k] describe bins [0, k], the right sweep bins [k + 1, n).
+      aabb running = aabb::empty;
+      int running_count = 0;
+      for (int k = 0; k < bin_count - 1; k++)
+      {
+        running = aabb(running, axis_bins[k].bbox);
+        running_count += axis_bins[k].count;
+        left_area[k] = area(running);
+        left_count[k] = running_count;
+      }
+
+      running = aabb::empty;
+      running_count = 0;
+      for (int k = bin_count - 1; k > 0; k--)
+      {
+        running = aabb(running, axis_bins[k].bbox);
+        running_count += axis_bins[k].count;
+
+        int left = left_count[k - 1];
+        if (left == 0 || running_count == 0) continue;
+
+        double cost = left_area[k - 1] * left + area(running) * running_count;
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = a;
+          best_bin = k;
+        }
+      }
+    }
+
+    // All centroids coincide: no plane separates them, so split by count.
+    if (best_axis < 0)
+      return must_split ? split_median(prims, start, end, axis) : start;
+
+    auto parent_area = area(bounds);
+    best_cost = options.traversal_cost +
+                options.intersection_cost * best_cost /
+                    (parent_area > 0 ? parent_area : 1);
+    if (!must_split && best_cost >= leaf_cost(count)) return start;
+
+    axis = best_axis;
+    auto mid = std::partition(prims.begin() + start, prims.begin() + end,
+                              [&](const bvh_primitive& p) {
+                                return bin_index(p, axis) < best_bin;
+                              });
+
+    return size_t(mid - prims.begin());
+  }
+
+  static size_t split_median(std::vector<bvh_primitive>& prims, size_t start,
+                             size_t end, int axis)
+  {
+    // Equal counts either side of the centroid median. Coincident centroids
+    // still split by count, which bounds the depth.
+    auto mid = start + (end - start) / 2;
+    std::nth_element(prims.begin() + start, prims.begin() + mid,
+                     prims.begin() + end,
+                     [axis](const bvh_primitive& a, const bvh_primitive& b) {
+                       return a.centroid[axis] < b.centroid[axis];
+                     });
+    return mid;
+  }
+};
+
+#endif
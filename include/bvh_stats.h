@@ -0,0 +1,98 @@
+#ifndef BVH_STATS_H
+#define BVH_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// BVH traversal statistics, compiled in only when TOYRENDERER_BVH_STATS is
+// defined (the CMake option of the same name); otherwise every hook is an
+// empty inline function.
+//
+// Each thread counts the rays it traces and the nodes they visit, and runs
+// the node addresses through a simulated 32 KiB direct-mapped cache of
+// 64-byte lines. The simulated miss rate is a proxy for how well consecutive
+// rays reuse the nodes that earlier ones brought in, not a hardware count.
+
+struct bvh_traversal_stats
+{
+  uint64_t rays = 0;
+  uint64_t nodes = 0;        // Nodes visited, over all rays
+  uint64_t node_misses = 0;  // Visits missing the simulated cache
+
+  friend std::ostream& operator<<(std::ostream& out,
+                                  const bvh_traversal_stats& s)
+  {
+    auto per_ray = s.rays ? double(s.nodes) / s.rays : 0.0;
+    auto miss_rate = s.nodes ? 100.0 * s.node_misses / s.nodes : 0.0;
+    return out << "BVH traversal: " << s.rays << " rays, " << per_ray
+               << " nodes per ray, " << miss_rate << "% node cache misses";
+  }
+};
+
+namespace bvh_stats
+{
+#ifdef TOYRENDERER_BVH_STATS
+  struct counters
+  {
+    static const int cache_lines = 512;
+
+    bvh_traversal_stats stats;
+    uintptr_t tags[cache_lines] = {};
+  };
+
+  inline counters& local()
+  {
+    thread_local counters c;
+    return c;
+  }
+
+  inline std::atomic<uint64_t> totals[3];
+
+  inline void ray() { local().stats.rays++; }
+
+  inline void visit(const void* node)
+  {
+    auto& c = local();
+    auto line = uintptr_t(node) >> 6;
+    auto& tag = c.tags[line % counters::cache_lines];
+    c.stats.nodes++;
+    if (tag != line)
+    {
+      tag = line;
+      c.stats.node_misses++;
+    }
+  }
+
+  // Adds this thread's counts to the totals and clears them.
+  inline void flush()
+  {
+    auto& s = local().stats;
+    totals[0] += s.rays;
+    totals[1] += s.nodes;
+    totals[2] += s.node_misses;
+    s = bvh_traversal_stats();
+  }
+
+  // Returns and clears the totals flushed so far.
+  inline bvh_traversal_stats take()
+  {
+    bvh_traversal_stats s;
+    s.rays = totals[0].exchange(0);
+    s.nodes = totals[1].exchange(0);
+    s.node_misses = totals[2].exchange(0);
+    return s;
+  }
+
+  constexpr bool enabled = true;
+#else
+  inline void ray() {}
+  inline void visit(const void*) {}
+  inline void flush() {}
+  inline bvh_traversal_stats take() { return bvh_traversal_stats(); }
+
+  constexpr bool enabled = false;
+#endif
+}  // namespace bvh_stats
+
+#endif
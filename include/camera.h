@@ -1,12 +1,25 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <mutex>
 
 #include "common.h"
+#include "aov.h"
+#include "bvh_stats.h"
+#include "denoiser.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_encoder.h"
+#include "light_list.h"
 #include "material.h"
+#include "material_table.h"
+#include "sampler.h"
+#include "thread_pool.h"
+#include "wavefront.h"
 
 class camera
 {
@@ -17,12 +30,16 @@ class camera
   point3 pixel00_loc;          // Location of pixel (0,0)
   vec3 pixel_delta_u;          // Offset to pixel to the right
   vec3 pixel_delta_v;          // offset to pixel below
+  double pixel_spread;         // Angle of the cone of a camera ray
 
   vec3 u, v, w;  // Camera frame basis vectors
 
   vec3 defocus_disk_u;  // Defocus disk horizontal radius
   vec3 defocus_disk_v;  // Defocus disk vertical radius
 
+  light_list lights;  // Emissive primitives of the scene being rendered
+  uint32_t gathered_aovs = 0;  // Outputs wanted, plus the denoiser's guides
+
   void initialize()
   {
     // Calculate the image height, and ensure that it's at least 1.
@@ -58,6 +75,12 @@ class camera
     pixel_delta_u = viewport_u / image_width;
     pixel_delta_v = viewport_v / image_height;
 
+    // A pixel's samples spread over it, so each stands for a smaller part:
+    // the cone of a camera ray narrows with more of them, down to an eighth
+    // of the pixel, as ray differentials do in pbrt.
+    pixel_spread = 2 * h / image_height *
+                   std::fmax(0.125, 1 / std::sqrt(double(samples_per_pixel)));
+
     // Calculate the location of the upper left pixel.
     auto viewport_upper_left =
         center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
@@ -70,64 +93,716 @@ class camera
     defocus_disk_v = v * defocus_radius;
   }
 
-  ray get_ray(int i, int j) const
+  ray get_ray(int i, int j, sampler& s) const
   {
     // Construct a camera ray originating from the defocus disk and directed at
-    // a randomly sampled point around the pixel location i, j.
+    // a sampled point around the pixel location i, j. The lens sample is
+    // drawn even without defocus so the dimensions of later samples do not
+    // depend on the camera settings.
 
-    auto offset = sample_square();
-    auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) +
-                        ((j + offset.y()) * pixel_delta_v);
+    auto offset = s.get_2d();
+    auto pixel_sample = pixel00_loc + ((i + offset.x - 0.5) * pixel_delta_u) +
+                        ((j + offset.y - 0.5) * pixel_delta_v);
 
-    auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+    auto lens = s.get_2d();
+    auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens);
     auto ray_direction = pixel_sample - ray_origin;
-    auto ray_time = random_double();
+    auto ray_time = s.get_1d();
 
     return ray(ray_origin, ray_direction, ray_time);
   }
 
-  vec3 sample_square() const
+  static double power_heuristic(double pdf, double other_pdf)
+  {
+    // Multiple importance sampling weight of a sample drawn with density
+    // `pdf`, when another technique could have drawn it with `other_pdf`.
+    auto a = pdf * pdf, b = other_pdf * other_pdf;
+    return a / (a + b);
+  }
+
+  struct shadow_ray
+  {
+    // A light sample waiting on its visibility test: `contribution` reaches
+    // the path if nothing blocks `r` before `distance`.
+    ray r;
+    double distance = 0;
+    color contribution = color(0, 0, 0);
+  };
+
+  // Sampler dimensions drawn for the camera ray, then for every bounce.
+  static const int camera_dimensions = 3;
+  static const int bounce_dimensions = 3;
+
+  bool sample_direct(const ray& r_in, const hit_record& rec,
+                     const material& mat, const sample2& u,
+                     shadow_ray& shadow) const
+  {
+    // Next-event estimation: light reaching the shaded point straight from a
+    // point sampled on the lights, weighted against the chance that the
+    // material's own sampling finds the same point. Returns false if there is
+    // nothing to test for visibility.
+    light_sample s;
+    if (!lights.sample(rec.p, r_in.time(), u, s)) return false;
+
+    auto scattering_pdf = mat.scattering_pdf(r_in, rec, s.direction);
+    if (scattering_pdf <= 0) return false;
+
+    auto bsdf = mat.eval(r_in, rec, s.direction);
+    if (bsdf.length_squared() == 0) return false;
+
+    const material* light_mat = material_table::get(s.point.mat_id);
+    auto emitted = light_mat->emitted(s.point.u, s.point.v, s.point.p, 0);
+
+    // Aimed again from the spawned origin, which moved off the surface, so
+    // the test still ends just short of the light point.
+    auto origin = rec.spawn_ray(s.direction, r_in.time()).origin();
+    auto to_light = s.point.p - origin;
+    shadow.distance = to_light.length();
+    shadow.r = ray(origin, to_light / shadow.distance, r_in.time());
+    shadow.contribution =
+        power_heuristic(s.pdf, scattering_pdf) * bsdf * emitted / s.pdf;
+    return true;
+  }
+
+  struct path_vertex
+  {
+    // The state a path carries from one bounce to the next.
+    ray r;
+    color throughput = color(1, 1, 1);
+    color radiance = color(0, 0, 0);
+
+    // Density with which the previous bounce picked r, or 0 if it could not
+    // have been found by light sampling (camera rays and specular bounces).
+    double scattering_pdf = 0;
+
+    // The ray's cone, which sets how wide an area texture lookups filter:
+    // its width where r starts, and the angle it widens by per unit length.
+    double cone_width = 0;
+    double cone_spread = 0;
+  };
+
+  static void set_footprint(const ray& r, double cone_width,
+                            double cone_spread, hit_record& rec)
+  {
+    // Measures the cone of ray r where it meets the surface at rec. A
+    // slanted cone covers an ellipse; lookups filter isotropically over the
+    // geometric mean of its axes, between blurring along the short one and
+    // aliasing along the long one.
+    auto length = r.direction().length();
+    auto width = cone_width + cone_spread * rec.t * length;
+    auto cosine = std::fabs(dot(r.direction(), rec.normal)) / length;
+    rec.footprint =
+        width * rec.uv_density / std::sqrt(std::fmax(cosine, 1e-3));
+  }
+
+  bool shade(path_vertex& path, const hit_record& rec, const material& mat,
+             int depth, sampler& s, shadow_ray& shadow,
+             bool& has_shadow) const
+  {
+    // One bounce of a path that hit `rec`: adds the emission found there,
+    // samples the lights into `shadow` for the caller to test, and moves the
+    // path on to its next ray. Returns false when the path ends. The sampler
+    // must be on the bounce's first dimension.
+    auto u_scatter = s.get_2d();
+    auto u_light = s.get_2d();
+    auto u_roulette = s.get_1d();
+    has_shadow = false;
+
+    color emission = mat.emitted(rec.u, rec.v, rec.p, rec.footprint);
+
+    // Emission found by a sampled bounce was also sampled directly at that
+    // bounce, so it only gets the scattering share of the MIS weight.
+    if (path.scattering_pdf > 0 && mat.is_emissive() && !lights.empty())
+      emission *= power_heuristic(path.scattering_pdf, lights.pdf(path.r, rec));
+    path.radiance += path.throughput * emission;
+
+    scatter_record srec;
+    if (!mat.scatter(path.r, rec, u_scatter, srec)) return false;
+
+    path.scattering_pdf = 0;
+    if (direct_lighting && !lights.empty() && !srec.is_specular())
+    {
+      path.scattering_pdf = srec.pdf;
+      has_shadow = sample_direct(path.r, rec, mat, u_light, shadow);
+      if (has_shadow)
+        shadow.contribution = path.throughput * shadow.contribution;
+    }
+
+    // Specular bounces carry their weight directly; sampled ones are
+    // divided by the density they were picked with.
+    path.throughput = path.throughput *
+                      (srec.is_specular() ? srec.bsdf : srec.bsdf / srec.pdf);
+
+    // Specular bounces pass the cone on as it is, ignoring the curvature of
+    // the surface. Sampled ones widen it to the cone whose solid angle is
+    // the share 1 / pdf a sample of their lobe stands for.
+    path.cone_width += path.cone_spread * rec.t * path.r.direction().length();
+    if (!srec.is_specular())
+      path.cone_spread =
+          std::fmax(path.cone_spread, 2 / std::sqrt(pi * srec.pdf));
+    path.r = srec.scattered;
+
+    // Russian roulette: past the first few bounces, end paths with a
+    // probability that grows as their throughput fades, and scale up the
+    // survivors to keep the estimate unbiased.
+    if (depth + 1 >= roulette_depth)
+    {
+      auto t = path.throughput;
+      auto survival =
+          std::fmin(0.95, std::fmax(t.x(), std::fmax(t.y(), t.z())));
+      if (u_roulette >= survival) return false;
+      path.throughput /= survival;
+    }
+    return true;
+  }
+
+  static bool unoccluded(const hittable_list& world, const ray& r,
+                         double distance)
   {
-    // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit
-    // square.
-    return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+    return !world.occluded(r, interval(0.001, distance - 0.001));
   }
 
-  color ray_color(const ray& r, int depth, const hittable_list& world) const
+  void add_first_hit(pixel_aovs& aovs, const ray& r,
+                     const hit_record* rec) const
   {
-    hit_record rec;
+    // Adds the outputs of a camera ray that hit `rec`, or that left the
+    // scene if it is null.
+    if (aovs.samples++ == 0 && rec)
+    {
+      aovs.material_id = rec->mat_id;
+      aovs.primitive_id = rec->prim_id;
+    }
 
-    // If we've exceeded the ray bounce limit, no more light is gathered
-    if (depth <= 0) return color(0, 0, 0);
+    if (!rec)
+    {
+      if (gathered_aovs & aov_albedo) aovs.albedo += background;
+      return;
+    }
+    if (gathered_aovs & aov_albedo)
+      aovs.albedo += material_table::get(rec->mat_id)->albedo(*rec);
+    aovs.normal += rec->normal;
+    aovs.depth += rec->t * r.direction().length();
+  }
 
-    // If the ray hits nothing, return the background color
-    if (!world.hit(r, interval(0.001, infinity), rec)) return background;
+  color ray_color(const ray& camera_ray, const hittable_list& world,
+                  sampler& s, pixel_aovs* aovs = nullptr) const
+  {
+    // Follows one path from the camera, adding the light found at each
+    // vertex scaled by the throughput: the product of the weights of the
+    // bounces so far. The path's outputs are added to `aovs`, if given.
 
-    ray scattered;
-    color attenuation;
-    color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+    path_vertex path;
+    path.r = camera_ray;
+    path.cone_spread = pixel_spread;
 
-    if (!rec.mat->scatter(r, rec, attenuation, scattered))
-      return color_from_emission;
+    for (int depth = 0; depth < max_depth; depth++)
+    {
+      hit_record rec;
+      bool found = world.hit(path.r, interval(0.001, infinity), rec);
+      if (found)
+        set_footprint(path.r, path.cone_width, path.cone_spread, rec);
+      if (aovs)
+      {
+        aovs->rays++;
+        if (depth == 0) add_first_hit(*aovs, path.r, found ? &rec : nullptr);
+      }
 
-    color color_from_scatter =
-        attenuation * ray_color(scattered, depth - 1, world);
+      // If the ray hits nothing, add the background color
+      if (!found)
+      {
+        path.radiance += path.throughput * background;
+        break;
+      }
 
-    return color_from_emission + color_from_scatter;
+      shadow_ray shadow;
+      bool has_shadow;
+      s.set_dimension(camera_dimensions + depth * bounce_dimensions);
+      bool more = shade(path, rec, *material_table::get(rec.mat_id), depth, s,
+                        shadow, has_shadow);
+      if (has_shadow)
+      {
+        if (aovs) aovs->rays++;
+        if (unoccluded(world, shadow.r, shadow.distance))
+          path.radiance += shadow.contribution;
+      }
+      if (!more) break;
+    }
+
+    return path.radiance;
   }
 
-  point3 defocus_disk_sample() const
+  point3 defocus_disk_sample(const sample2& u) const
   {
-    // Returns a random point in the camera defocus disk.
-    auto p = random_in_unit_disk();
+    // Returns the point of the camera defocus disk that u maps to.
+    auto p = sample_concentric_disk(u);
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
+  template <typename Fn>
+  void for_each_tile_pixel(int tile_index, int tiles_x, Fn fn) const
+  {
+    int x0 = (tile_index % tiles_x) * tile_size;
+    int y0 = (tile_index / tiles_x) * tile_size;
+    int x1 = std::min(x0 + tile_size, image_width);
+    int y1 = std::min(y0 + tile_size, image_height);
+
+    for (int j = y0; j < y1; j++)
+      for (int i = x0; i < x1; i++) fn(i, j);
+  }
+
+  void render_tile(const hittable_list& world, int tile_index, int tiles_x,
+                   framebuffer& image, aov_buffers* aovs) const
+  {
+    // Renders one tile into its own disjoint region of the framebuffer, so
+    // workers never need to synchronise on pixel writes. Outputs other than
+    // the color go to `aovs`, if given.
+
+    auto s = pixel_sampler->clone(samples_per_pixel);
+    for_each_tile_pixel(tile_index, tiles_x, [&](int i, int j) {
+      color pixel_color(0, 0, 0);
+      pixel_aovs outputs;
+      for (int sample = 0; sample < samples_per_pixel; sample++)
+      {
+        // Every number of this sample, from the sub-pixel offset to the last
+        // bounce, is keyed on (pixel, sample), which makes renders
+        // reproducible regardless of scheduling.
+        s->start_sample(i, j, sample);
+
+        ray r = get_ray(i, j, *s);
+        pixel_color += ray_color(r, world, *s, aovs ? &outputs : nullptr);
+      }
+
+      image.set(i, j, pixel_samples_scale * pixel_color);
+      if (aovs) aovs->set(i, j, outputs, pixel_samples_scale);
+    });
+  }
+
+  // Paths the wavefront integrator keeps in flight per worker.
+  static const int wavefront_paths = 1 << 14;
+
+  static uint32_t spread_bits(uint32_t x)
+  {
+    // Moves bit i of a 10-bit number to bit 3i, for interleaving.
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x030000ff;
+    x = (x | x << 8) & 0x0300f00f;
+    x = (x | x << 4) & 0x030c30c3;
+    x = (x | x << 2) & 0x09249249;
+    return x;
+  }
+
+  void sort_rays_by_key(const path_queue& paths, std::vector<uint32_t>& slots,
+                        std::vector<std::pair<uint64_t, uint32_t>>& keys) const
+  {
+    // Reorders the slots so rays that start close together and head into the
+    // same octant are traced one after another, and reuse the BVH nodes the
+    // previous ones brought into cache. The key is the direction octant,
+    // then the Morton code of the origin on a 1024^3 grid over the origins.
+    if (slots.size() < 2) return;
+
+    double lo[3] = {infinity, infinity, infinity};
+    double hi[3] = {-infinity, -infinity, -infinity};
+    const std::vector<real>* origin[3] = {&paths.rays.ox, &paths.rays.oy,
+                                          &paths.rays.oz};
+    const std::vector<real>* dir[3] = {&paths.rays.dx, &paths.rays.dy,
+                                       &paths.rays.dz};
+    for (auto slot : slots)
+      for (int a = 0; a < 3; a++)
+      {
+        lo[a] = std::fmin(lo[a], (*origin[a])[slot]);
+        hi[a] = std::fmax(hi[a], (*origin[a])[slot]);
+      }
+
+    keys.clear();
+    for (auto slot : slots)
+    {
+      uint64_t octant = 0, morton = 0;
+      for (int a = 0; a < 3; a++)
+      {
+        octant |= uint64_t((*dir[a])[slot] < 0) << a;
+        auto extent = hi[a] - lo[a];
+        auto cell = extent > 0 ? ((*origin[a])[slot] - lo[a]) / extent : 0.0;
+        morton |= uint64_t(spread_bits(uint32_t(cell * 1023))) << a;
+      }
+      keys.emplace_back(octant << 30 | morton, slot);
+    }
+
+    std::sort(keys.begin(), keys.end());
+    for (size_t k = 0; k < keys.size(); k++) slots[k] = keys[k].second;
+  }
+
+  void intersect_camera_packets(const hittable_list& world, path_queue& paths,
+                                int wave_size, int tile_width, int tile_height,
+                                std::vector<uint32_t>& hits) const
+  {
+    // The intersect stage for camera rays. Rays of neighbouring pixels leave
+    // the same point, or a small lens, in nearly the same direction, so the
+    // rays of each block of pixels for one sample trace as a packet.
+    const int side = ray_packet::side;
+    int pixel_count = tile_width * tile_height;
+
+    for (int base = 0; base < wave_size; base += pixel_count)
+      for (int by = 0; by < tile_height; by += side)
+        for (int bx = 0; bx < tile_width; bx += side)
+        {
+          ray_packet packet;
+          uint32_t slots[ray_packet::size];
+          int lanes = 0;
+          for (int y = by; y < std::min(by + side, tile_height); y++)
+            for (int x = bx; x < std::min(bx + side, tile_width); x++)
+            {
+              auto slot = uint32_t(base + y * tile_width + x);
+              packet.set(lanes, paths.rays.get(slot),
+                         interval(0.001, infinity));
+              slots[lanes++] = slot;
+            }
+
+          world.intersect_packet(packet, packet.active);
+
+          for (int k = 0; k < lanes; k++)
+          {
+            auto slot = slots[k];
+            if (packet.found & (1u << k))
+            {
+              const auto& h = packet.hits[k];
+              h.object->finalize(packet.get(k), h, paths.hits[slot]);
+              hits.push_back(slot);
+            }
+            else
+              paths.radiance.add(slot,
+                                 paths.throughput.get(slot) * background);
+          }
+        }
+  }
+
+  void render_wavefront_tile(const hittable_list& world, int tile_index,
+                             int tiles_x, framebuffer& image,
+                             aov_buffers* aovs) const
+  {
+    // Renders a tile breadth-first: the paths of many samples go through
+    // each stage of a bounce together (intersect, shade grouped by material,
+    // test shadow rays), so every stage runs one piece of code over
+    // contiguous data. Produces the same image as render_tile.
+
+    std::vector<std::pair<int, int>> pixels;
+    for_each_tile_pixel(tile_index, tiles_x,
+                        [&](int i, int j) { pixels.emplace_back(i, j); });
+    int pixel_count = int(pixels.size());
+    int tile_width = pixels.back().first - pixels.front().first + 1;
+    int tile_height = pixel_count / tile_width;
+    std::vector<color> sums(pixels.size(), color(0, 0, 0));
+    std::vector<pixel_aovs> outputs(aovs ? pixels.size() : 0);
+
+    auto s = pixel_sampler->clone(samples_per_pixel);
+    int wave_samples =
+        std::clamp(wavefront_paths / pixel_count, 1, samples_per_pixel);
+
+    path_queue paths;
+    paths.resize(size_t(pixel_count) * wave_samples);
+    shadow_queue shadows;
+    std::vector<uint32_t> active, hits, sorted, material_start;
+    std::vector<uint8_t> found;
+    std::vector<std::pair<uint64_t, uint32_t>> ray_keys;
+
+    for (int first = 0; first < samples_per_pixel; first += wave_samples)
+    {
+      int wave_size =
+          pixel_count * std::min(wave_samples, samples_per_pixel - first);
+
+      // Generate: a camera ray for every slot, sample-major, so each pixel's
+      // samples are summed in the same order as render_tile's.
+      active.clear();
+      for (int slot = 0; slot < wave_size; slot++)
+      {
+        int p = slot % pixel_count, sample = first + slot / pixel_count;
+        s->start_sample(pixels[p].first, pixels[p].second, sample);
+        paths.rays.set(slot, get_ray(pixels[p].first, pixels[p].second, *s));
+        paths.throughput.set(slot, color(1, 1, 1));
+        paths.radiance.set(slot, color(0, 0, 0));
+        paths.scattering_pdf[slot] = 0;
+        paths.cone_width[slot] = 0;
+        paths.cone_spread[slot] = pixel_spread;
+        paths.pixel[slot] = p;
+        paths.sample[slot] = sample;
+        active.push_back(uint32_t(slot));
+      }
+
+      for (int depth = 0; depth < max_depth && !active.empty(); depth++)
+      {
+        // Intersect: paths that leave the scene take the background and end.
+        hits.clear();
+        if (depth == 0 && camera_packets)
+          intersect_camera_packets(world, paths, wave_size, tile_width,
+                                   tile_height, hits);
+        else
+        {
+          if (sort_rays && depth > 0) sort_rays_by_key(paths, active, ray_keys);
+          for (auto slot : active)
+          {
+            if (world.hit(paths.rays.get(slot), interval(0.001, infinity),
+                          paths.hits[slot]))
+              hits.push_back(slot);
+            else
+              paths.radiance.add(slot,
+                                 paths.throughput.get(slot) * background);
+          }
+        }
+        for (auto slot : hits)
+          set_footprint(paths.rays.get(slot), paths.cone_width[slot],
+                        paths.cone_spread[slot], paths.hits[slot]);
+
+        if (aovs)
+        {
+          for (auto slot : active) outputs[paths.pixel[slot]].rays++;
+
+          // First hits are added in slot order, like the colors.
+          if (depth == 0)
+          {
+            found.assign(wave_size, 0);
+            for (auto slot : hits) found[slot] = 1;
+            for (int slot = 0; slot < wave_size; slot++)
+              add_first_hit(outputs[paths.pixel[slot]], paths.rays.get(slot),
+                            found[slot] ? &paths.hits[slot] : nullptr);
+          }
+        }
+
+        // Group the hits by material with a counting sort, so each material
+        // shades all of its paths in one batch.
+        material_start.assign(material_table::size() + 1, 0);
+        for (auto slot : hits) material_start[paths.hits[slot].mat_id + 1]++;
+        for (size_t m = 1; m < material_start.size(); m++)
+          material_start[m] += material_start[m - 1];
+        sorted.resize(hits.size());
+        for (auto slot : hits)
+          sorted[material_start[paths.hits[slot].mat_id]++] = slot;
+
+        // Shade: emission, scattering and light sampling, queueing the shadow
+        // rays and the paths that go on.
+        active.clear();
+        shadows.clear();
+        for (auto slot : sorted)
+        {
+          const auto& rec = paths.hits[slot];
+          const material* mat = material_table::get(rec.mat_id);
+
+          path_vertex path;
+          path.r = paths.rays.get(slot);
+          path.throughput = paths.throughput.get(slot);
+          path.radiance = paths.radiance.get(slot);
+          path.scattering_pdf = paths.scattering_pdf[slot];
+          path.cone_width = paths.cone_width[slot];
+          path.cone_spread = paths.cone_spread[slot];
+
+          auto& pixel = pixels[paths.pixel[slot]];
+          s->start_sample(pixel.first, pixel.second, paths.sample[slot]);
+          s->set_dimension(camera_dimensions + depth * bounce_dimensions);
+
+          shadow_ray shadow;
+          bool has_shadow;
+          bool more = shade(path, rec, *mat, depth, *s, shadow, has_shadow);
+
+          paths.rays.set(slot, path.r);
+          paths.throughput.set(slot, path.throughput);
+          paths.radiance.set(slot, path.radiance);
+          paths.scattering_pdf[slot] = path.scattering_pdf;
+          paths.cone_width[slot] = path.cone_width;
+          paths.cone_spread[slot] = path.cone_spread;
+
+          if (has_shadow)
+            shadows.push(slot, shadow.r, shadow.distance, shadow.contribution);
+          if (more) active.push_back(slot);
+        }
+
+        // Shadow: any-hit tests, adding the light that gets through.
+        for (size_t k = 0; k < shadows.size(); k++)
+          if (unoccluded(world, shadows.rays.get(k), shadows.distance[k]))
+            paths.radiance.add(shadows.path[k], shadows.contribution.get(k));
+        if (aovs)
+          for (auto slot : shadows.path) outputs[paths.pixel[slot]].rays++;
+      }
+
+      // Accumulate
+      for (int slot = 0; slot < wave_size; slot++)
+        sums[paths.pixel[slot]] += paths.radiance.get(slot);
+    }
+
+    for (int p = 0; p < pixel_count; p++)
+    {
+      image.set(pixels[p].first, pixels[p].second,
+                pixel_samples_scale * sums[p]);
+      if (aovs)
+        aovs->set(pixels[p].first, pixels[p].second, outputs[p],
+                  pixel_samples_scale);
+    }
+  }
+
+  struct pixel_state
+  {
+    // Running estimate of one pixel for adaptive sampling. Mean and variance
+    // are tracked (Welford) for the displayed luminance, gamma-corrected and
+    // clamped, so fireflies well past white do not keep a pixel sampling.
+    color sum = color(0, 0, 0);
+    int count = 0;
+    double mean = 0;
+    double m2 = 0;
+    int next = 0;  // Samples to take in the coming pass
+    pixel_aovs outputs;
+
+    void add(const color& c)
+    {
+      sum += c;
+      count++;
+
+      auto luminance = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+      auto x = linear_to_gamma(std::fmin(luminance, 1.0));
+      auto delta = x - mean;
+      mean += delta / count;
+      m2 += delta * (x - mean);
+    }
+
+    // Half-width of the 95% confidence interval of the mean.
+    double error() const
+    {
+      if (count < 2) return infinity;
+      return 1.96 * std::sqrt(m2 / ((count - 1) * double(count)));
+    }
+  };
+
+  // Adaptive pixels stop at this multiple of samples_per_pixel.
+  static const int adaptive_max_factor = 8;
+
+  void sample_pixel(const hittable_list& world, int i, int j,
+                    pixel_state& state, sampler& s) const
+  {
+    // Takes the pixel's planned samples, continuing its sample numbering so
+    // the random sequence of each sample is the same whatever the pass.
+    for (; state.next > 0; state.next--)
+    {
+      s.start_sample(i, j, state.count);
+      state.add(ray_color(get_ray(i, j, s), world, s,
+                          gathered_aovs ? &state.outputs : nullptr));
+    }
+  }
+
+  int64_t plan_pass(std::vector<pixel_state>& states, int64_t budget) const
+  {
+    // Plans the next adaptive pass and returns its sample count. Pixels
+    // still wider than the threshold may double their samples. Another
+    // sample cuts a pixel's squared error by about error^2 / count, so when
+    // the budget cannot cover every pixel, the pixels where that is largest
+    // go first. Each pass spends at most half of what is left, so later
+    // passes can revise the estimates.
+
+    int cap = adaptive_max_factor * samples_per_pixel;
+    std::vector<std::pair<double, size_t>> candidates;
+    int64_t wanted = 0;
+    for (size_t k = 0; k < states.size(); k++)
+    {
+      auto& state = states[k];
+      auto error = state.error();
+      state.next = 0;
+      if (error <= adaptive_threshold || state.count >= cap) continue;
+
+      candidates.emplace_back(error * error / state.count, k);
+      wanted += std::min(state.count, cap - state.count);
+    }
+
+    auto pass_budget = std::min(wanted, std::max(budget / 2, int64_t(1)));
+    if (budget <= 0 || candidates.empty()) return 0;
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    int64_t planned = 0;
+    for (const auto& candidate : candidates)
+    {
+      if (planned >= pass_budget) break;
+      auto& state = states[candidate.second];
+      state.next = int(std::min<int64_t>(
+          std::min(state.count, cap - state.count), budget - planned));
+      planned += state.next;
+    }
+    return planned;
+  }
+
+  void render_adaptive(const hittable_list& world, thread_pool& pool,
+                       int tile_count, int tiles_x, framebuffer& image,
+                       framebuffer& sample_counts, aov_buffers* aovs)
+  {
+    // Every pixel first takes adaptive_min_samples. Later passes revisit the
+    // pixels whose confidence interval is still wider than
+    // adaptive_threshold, until they converge, reach their cap, or the total
+    // budget of samples_per_pixel per pixel runs out, so the samples that
+    // converged pixels leave unused go to the noisy ones.
+
+    std::vector<pixel_state> states(size_t(image_width) * image_height);
+    // Two samples at least, for a variance; render() only comes here with
+    // a budget that allows them.
+    auto first_pass =
+        std::min(std::max(adaptive_min_samples, 2), samples_per_pixel);
+    for (auto& state : states) state.next = first_pass;
+
+    auto budget = int64_t(samples_per_pixel) * int64_t(states.size());
+    auto planned = first_pass * int64_t(states.size());
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (int pass = 1; planned > 0; pass++)
+    {
+      std::atomic<int> tiles_done(0);
+      std::mutex progress_mutex;
+
+      pool.parallel_for(tile_count, [&](int tile, int) {
+        auto s = pixel_sampler->clone(samples_per_pixel * adaptive_max_factor);
+        for_each_tile_pixel(tile, tiles_x, [&](int i, int j) {
+          sample_pixel(world, i, j, states[size_t(j) * image_width + i], *s);
+        });
+        bvh_stats::flush();
+
+        int done = ++tiles_done;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        auto now = std::chrono::steady_clock::now();
+        std::clog << "\r" << std::string(80, ' ') << "\r";
+        std::clog << "Elapsed Time: " << format_elapsed_time(start_time, now)
+                  << " | Pass " << pass << " | Samples: " << planned
+                  << " | Tiles remaining: " << (tile_count - done)
+                  << std::flush;
+      });
+
+      budget -= planned;
+      planned = plan_pass(states, budget);
+    }
+
+    int64_t total = 0;
+    int max_count = 1;
+    for (const auto& state : states)
+    {
+      total += state.count;
+      max_count = std::max(max_count, state.count);
+    }
+
+    for (int j = 0; j < image_height; j++)
+    {
+      for (int i = 0; i < image_width; i++)
+      {
+        const auto& state = states[size_t(j) * image_width + i];
+        image.set(i, j, state.sum / state.count);
+        if (aovs) aovs->set(i, j, state.outputs, 1.0 / state.count);
+        auto level = double(state.count) / max_count;
+        sample_counts.set(i, j, color(level, level, level));
+      }
+    }
+
+    std::clog << "\rEffective samples per pixel: "
+              << double(total) / double(states.size()) << " (max "
+              << max_count << ")" << std::string(30, ' ') << '\n';
+  }
+
  public:
   double aspect_ratio = 1.0;   // Ratio of image width over height
   int image_width = 100;       // Rendered image width in pixel count
   int samples_per_pixel = 10;  // Count of random samples for each pixel
   int max_depth = 10;          // Maximum number of ray bounces into scene
+  int roulette_depth = 3;      // Bounces before paths may end by roulette
   color background;            // Scene background color
 
   double vfov = 90;                   // Vertical view angle (field of view)
@@ -139,60 +814,158 @@ class camera
   double focus_dist = 10;    // Distance from camera lookfrom point to plane
                              // of perfect focus
 
+  bool direct_lighting = true;  // Sample lights explicitly at diffuse hits
+
+  // Adaptive sampling, enabled by a positive threshold: pixels stop once the
+  // 95% confidence interval of their displayed luminance (0 to 1) is
+  // narrower than the threshold, and the image averages samples_per_pixel.
+  // Needs samples_per_pixel of 2 or more, and is off below that.
+  double adaptive_threshold = 0;
+  int adaptive_min_samples = 16;  // Samples every pixel takes first
+
+  // Source of the sample points of each camera path. The independent
+  // sampler matches plain random sampling; stratified, Sobol and blue-noise
+  // samplers spread the points of a pixel more evenly.
+  shared_ptr<sampler> pixel_sampler = make_shared<independent_sampler>();
+
+  // Trace the paths of each tile breadth-first, in batches that move through
+  // the stages of a bounce together. Gives the same image; adaptive sampling
+  // always renders depth-first.
+  bool wavefront = false;
+  bool camera_packets = true;  // Wavefront camera rays trace in 4x4 packets
+  bool sort_rays = false;  // Wavefront bounces sort rays by origin and octant
+
+  // Filter the finished image with an edge-avoiding wavelet denoiser,
+  // guided by the albedo, normal and depth of the camera rays' first hits,
+  // which the render gathers alongside the color.
+  bool denoise = false;
+  denoiser image_denoiser;  // Settings of the denoiser
+
+  // Mask of aov flags: images besides the color, gathered from the same
+  // paths and written next to it in aov_encoder's format, which by default
+  // keeps their values exact.
+  uint32_t aovs = 0;
+  shared_ptr<image_encoder> aov_encoder = make_shared<pfm_encoder>();
+
+  int thread_count = 0;  // Render worker threads (0 = one per hardware thread)
+  int tile_size = 32;    // Edge length of the square render tiles, in pixels
+
+  shared_ptr<image_encoder> encoder =
+      make_shared<ppm_encoder>();  // Output image format
+
   void render(const hittable_list& world)
   {
     initialize();
+    lights = light_list(world);
 
     // Create output file for the render
-    // TODO: Move this to its own thing at some point
-    auto filename = generate_filename("renders/image", "ppm");
-    std::ofstream outfile(filename);
+    auto filename = generate_filename("renders/image", encoder->extension());
+    std::ofstream outfile(filename, std::ios::binary);
     if (!outfile)
     {
       std::cerr << "Error: Could not open the file for writing.\n";
       return;
     }
 
-    // Write header to the file
-    outfile << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    // Split the image into tiles, which the worker pool pulls from its
+    // work-stealing queues. Tiles finish in any order, so they are gathered in
+    // a framebuffer and encoded once the whole image is done.
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+    int tile_count = tiles_x * tiles_y;
+
+    framebuffer image(image_width, image_height);
+    thread_pool pool(thread_count);
+
+    gathered_aovs = aovs;
+    if (denoise) gathered_aovs |= aov_depth | aov_normal | aov_albedo;
+    std::unique_ptr<aov_buffers> outputs;
+    if (gathered_aovs)
+      outputs = std::make_unique<aov_buffers>(image_width, image_height,
+                                              gathered_aovs);
 
     // Calculate time metrics
     auto start_time = std::chrono::steady_clock::now();
-    std::chrono::duration<int> delta = 0s;
-    auto now = std::chrono::steady_clock::now();
+    std::atomic<int> tiles_done(0);
+    std::mutex progress_mutex;
 
-    // Render each scanlines
-    for (int j = 0; j < image_height; j++)
+    if (adaptive_threshold > 0 && samples_per_pixel >= 2)
+    {
+      // The sample-count image shows where the budget went, scaled so the
+      // most sampled pixel is white.
+      framebuffer sample_counts(image_width, image_height);
+      render_adaptive(world, pool, tile_count, tiles_x, image, sample_counts,
+                      outputs.get());
+
+      auto counts_filename =
+          generate_filename("renders/samples", encoder->extension());
+      std::ofstream counts_file(counts_filename, std::ios::binary);
+      if (!counts_file || !encoder->write(counts_file, sample_counts))
+        std::cerr << "Error: Could not write " << counts_filename << ".\n";
+    }
+    else
     {
-      // Calculate metrics
-      auto temp = now;
-      now = std::chrono::steady_clock::now();
-      delta += std::chrono::duration_cast<std::chrono::seconds>(now - temp);
-      auto avg_delta = delta / j;
+      pool.parallel_for(tile_count, [&](int tile, int) {
+        if (wavefront)
+          render_wavefront_tile(world, tile, tiles_x, image, outputs.get());
+        else
+          render_tile(world, tile, tiles_x, image, outputs.get());
+        bvh_stats::flush();
+
+        int done = ++tiles_done;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        auto now = std::chrono::steady_clock::now();
+        std::clog << "\r" << std::string(80, ' ') << "\r";
+        std::clog << "Elapsed Time: " << format_elapsed_time(start_time, now)
+                  << " | " << "Tiles remaining: " << (tile_count - done)
+                  << std::flush;
+      });
+    }
 
-      std::clog << "\r" << std::string(80, ' ') << "\r";
-      std::clog << "Elapsed Time: " << format_elapsed_time(start_time, now)
-                << " (Δt̄= " << avg_delta.count() << "s)" << " | "
-                << "Scanlines remaining: " << (image_height - j) << std::flush;
+    auto render_end = std::chrono::steady_clock::now();
+    if (denoise) image_denoiser.apply(image, *outputs, pool);
+    auto denoise_end = std::chrono::steady_clock::now();
 
-      // Actual rendering
-      for (int i = 0; i < image_width; i++)
-      {
-        color pixel_color(0, 0, 0);
-        for (int sample = 0; sample < samples_per_pixel; sample++)
-        {
-          ray r = get_ray(i, j);
-          pixel_color += ray_color(r, max_depth, world);
-        }
+    if (!encoder->write(outfile, image))
+      std::cerr << "\nError: Could not write " << filename << ".\n";
 
-        write_color(outfile, pixel_samples_scale * pixel_color);
-      }
+    double most_rays = 0;
+    if (outputs)
+    {
+      most_rays = outputs->normalize_cost();
+      outputs->for_each([&](aov output, const std::string& name,
+                            const framebuffer& output_image) {
+        if (!(aovs & output)) return;
+        auto output_filename =
+            generate_filename("renders/" + name, aov_encoder->extension());
+        std::ofstream output_file(output_filename, std::ios::binary);
+        if (!output_file || !aov_encoder->write(output_file, output_image))
+          std::cerr << "Error: Could not write " << output_filename << ".\n";
+      });
     }
 
-    now = std::chrono::steady_clock::now();
+    auto now = std::chrono::steady_clock::now();
     std::clog
-        << "\rDone in " << format_elapsed_time(start_time, now)
-        << ".                                                           \n";
+        << "\rDone in " << format_elapsed_time(start_time, now) << " on "
+        << pool.size() << " thread(s)."
+        << "                                                 \n";
+    if (aovs & aov_cost)
+      std::clog << "Cost image scaled to " << most_rays << " rays per pixel.\n";
+    if (denoise)
+      std::clog << "Denoised in "
+                << std::chrono::duration<double, std::milli>(denoise_end -
+                                                             render_end)
+                       .count()
+                << " ms.\n";
+
+    if (bvh_stats::enabled)
+    {
+      auto stats = bvh_stats::take();
+      auto seconds =
+          std::chrono::duration<double>(render_end - start_time).count();
+      std::clog << stats << ", " << stats.rays / seconds / 1e6
+                << " Mrays/s\n";
+    }
 
     return;
   }
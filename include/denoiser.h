@@ -0,0 +1,244 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "aov.h"
+#include "common.h"
+#include "framebuffer.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+class denoiser
+{
+  // Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), guided by
+  // the depth, normal and albedo of the camera rays' first hits. Every pass
+  // blurs with a 5x5 B3-spline kernel whose taps are twice as far apart as in
+  // the pass before, so n passes cover 4 (2^n - 1) + 1 pixels across at 25
+  // taps per pixel each. A tap's weight falls off with its difference to the
+  // center pixel in color, albedo, normal and depth, which keeps the blur
+  // from crossing edges.
+  //
+  // Path tracing noise is in the lighting, while texture detail is sharp in
+  // the albedo image, so the filter runs on color divided by albedo and
+  // multiplies the albedo back in at the end.
+  //
+  // The image is kept as planes of floats and every tap runs over a whole
+  // row at once, a loop without branches that the compiler vectorizes, and
+  // builds for AVX2 too where the CPU has it. Rows are spread over the thread
+  // pool.
+
+ public:
+  // The defaults suit 16 samples per pixel: more passes also blur away
+  // lighting detail, like soft shadow edges, that the guides cannot see.
+  int passes = 2;
+  double sigma_color = 4;     // Illumination difference, halved every pass
+  double sigma_albedo = 0.1;  // Length of the albedo difference
+  double sigma_normal = 0.3;  // Length of the normal difference
+  double sigma_depth = 0.02;  // Relative depth difference per pixel of reach
+
+  // Filters `image` in place. The depth, normal and albedo outputs of
+  // `aovs` must be enabled.
+  void apply(framebuffer& image, const aov_buffers& aovs,
+             thread_pool& pool) const
+  {
+    int width = image.width(), height = image.height();
+    size_t count = size_t(width) * height;
+
+    planes p;
+    p.width = width;
+    for (auto plane : {&p.color[0], &p.color[1], &p.color[2], &p.filtered[0],
+                       &p.filtered[1], &p.filtered[2], &p.albedo[0],
+                       &p.albedo[1], &p.albedo[2], &p.normal[0], &p.normal[1],
+                       &p.normal[2], &p.depth, &p.depth_scale})
+      plane->resize(count);
+
+    // Demodulate. Albedo components too dark to divide by are left out of
+    // the split, so black surfaces filter their color as it is.
+    pool.parallel_for(height, [&](int y, int) {
+      for (int x = 0; x < width; x++)
+      {
+        auto k = size_t(y) * width + x;
+        auto c = image.at(x, y), a = aovs.get(aov_albedo).at(x, y);
+        auto n = aovs.get(aov_normal).at(x, y);
+        auto d = aovs.get(aov_depth).at(x, y).x();
+        for (int i = 0; i < 3; i++)
+        {
+          auto modulation = a[i] > 0.01 ? a[i] : 1.0;
+          p.albedo[i][k] = float(modulation);
+          p.color[i][k] = float(c[i] / modulation);
+          p.normal[i][k] = float(n[i]);
+        }
+        p.depth[k] = float(d);
+        p.depth_scale[k] = float(1 / (sigma_depth * std::fmax(d, 1e-6)));
+      }
+    });
+
+    std::vector<std::vector<float>> scratch(pool.size(),
+                                            std::vector<float>(4 * width));
+    auto color_weight = 1 / (sigma_color * sigma_color);
+    for (int pass = 0; pass < passes; pass++)
+    {
+      int step = 1 << pass;
+      weights w;
+      w.color = float(color_weight);
+      w.albedo = float(1 / (sigma_albedo * sigma_albedo));
+      w.normal = float(1 / (sigma_normal * sigma_normal));
+      w.depth = float(1.0 / (double(step) * step));
+
+      pool.parallel_for(height, [&](int y, int worker) {
+        filter_row(p, y, height, step, w, scratch[worker].data());
+      });
+      std::swap(p.color, p.filtered);
+      color_weight *= 4;
+    }
+
+    // Remodulate
+    pool.parallel_for(height, [&](int y, int) {
+      for (int x = 0; x < width; x++)
+      {
+        auto k = size_t(y) * width + x;
+        image.set(x, y,
+                  color(p.color[0][k] * p.albedo[0][k],
+                        p.color[1][k] * p.albedo[1][k],
+                        p.color[2][k] * p.albedo[2][k]));
+      }
+    });
+  }
+
+ private:
+  struct planes
+  {
+    int width = 0;
+    std::vector<float> color[3], filtered[3];  // Demodulated, RGB
+    std::vector<float> albedo[3];              // Divided out of the color
+    std::vector<float> normal[3];
+    std::vector<float> depth;
+    std::vector<float> depth_scale;  // 1 / (sigma_depth * depth)
+  };
+
+  struct weights
+  {
+    // Reciprocal squared sigmas, scaling the squared differences; depth's
+    // is 1 / step^2, so its tolerance grows with the reach of the taps.
+    float color, albedo, normal, depth;
+
+    // Largest exponent passed to fast_exp, which must stay in its range. A
+    // member rather than a constant: with a constant bound, GCC splits the
+    // loop on the clamp and no longer vectorizes it.
+    float cutoff = 87;
+  };
+
+  static float fast_exp(float x)
+  {
+    // e^x for x in [-87, 0], with a relative error below 4e-5. The integer
+    // part of x / ln 2 goes straight into the exponent bits, the fraction
+    // through a Taylor polynomial of 2^f.
+    float y = x * 1.44269504f;
+    auto n = int32_t(y);  // Rounds towards 0, leaving f in ]-1, 0]
+    float f = (y - float(n)) * 0.69314718f;
+    float p = 1 + f * (1 + f * (1.0f / 2 + f * (1.0f / 6 + f * (1.0f / 24 +
+                  f * (1.0f / 120 + f * (1.0f / 720))))));
+    int32_t bits = (n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+  }
+
+  static void filter_row(planes& p, int y, int height, int step,
+                         const weights& w, float* scratch)
+  {
+    // One pass over row y, from p.color into p.filtered. The sums of the
+    // weighted colors and of the weights are gathered a whole tap at a time;
+    // taps falling outside the image are left out.
+    static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4,
+                                    1.0f / 16};
+    int width = p.width;
+    float* sum_r = scratch;
+    float* sum_g = scratch + width;
+    float* sum_b = scratch + 2 * width;
+    float* sum_w = scratch + 3 * width;
+    std::fill(scratch, scratch + 4 * width, 0.0f);
+
+    auto row = size_t(y) * width;
+    for (int ty = -2; ty <= 2; ty++)
+    {
+      int qy = y + ty * step;
+      if (qy < 0 || qy >= height) continue;
+
+      for (int tx = -2; tx <= 2; tx++)
+      {
+        int offset = tx * step;
+        int lo = std::max(0, -offset), hi = std::min(width, width - offset);
+        tap(p, row, size_t(qy) * width, offset, lo, hi,
+            kernel[ty + 2] * kernel[tx + 2], w, sum_r, sum_g, sum_b, sum_w);
+      }
+    }
+
+    for (int x = 0; x < width; x++)
+    {
+      // The center tap always counts, so the sum of weights is positive.
+      auto inverse = 1 / sum_w[x];
+      p.filtered[0][row + x] = sum_r[x] * inverse;
+      p.filtered[1][row + x] = sum_g[x] * inverse;
+      p.filtered[2][row + x] = sum_b[x] * inverse;
+    }
+  }
+
+  TOYRENDERER_DISPATCH
+  static void tap(const planes& p, size_t row, size_t q_row, int offset,
+                  int lo, int hi, float h, const weights& w,
+                  float* __restrict sum_r,
+                  float* __restrict sum_g, float* __restrict sum_b,
+                  float* __restrict sum_w)
+  {
+    // Adds the pixels of q_row, shifted by offset, with kernel weight h to
+    // the pixels [lo, hi[ of a row.
+    const float *cr = p.color[0].data() + row, *cg = p.color[1].data() + row,
+                *cb = p.color[2].data() + row;
+    const float *ar = p.albedo[0].data() + row, *ag = p.albedo[1].data() + row,
+                *ab = p.albedo[2].data() + row;
+    const float *nx = p.normal[0].data() + row, *ny = p.normal[1].data() + row,
+                *nz = p.normal[2].data() + row;
+    const float *z = p.depth.data() + row, *zs = p.depth_scale.data() + row;
+
+    const float *qr = p.color[0].data() + q_row,
+                *qg = p.color[1].data() + q_row,
+                *qb = p.color[2].data() + q_row;
+    const float *qar = p.albedo[0].data() + q_row,
+                *qag = p.albedo[1].data() + q_row,
+                *qab = p.albedo[2].data() + q_row;
+    const float *qnx = p.normal[0].data() + q_row,
+                *qny = p.normal[1].data() + q_row,
+                *qnz = p.normal[2].data() + q_row;
+    const float* qz = p.depth.data() + q_row;
+
+    for (int x = lo; x < hi; x++)
+    {
+      int k = x + offset;
+      float r = qr[k], g = qg[k], b = qb[k];
+      float dr = r - cr[x], dg = g - cg[x], db = b - cb[x];
+      float da_r = qar[k] - ar[x], da_g = qag[k] - ag[x],
+            da_b = qab[k] - ab[x];
+      float dnx = qnx[k] - nx[x], dny = qny[k] - ny[x], dnz = qnz[k] - nz[x];
+      float dz = (qz[k] - z[x]) * zs[x];
+
+      float e = w.color * (dr * dr + dg * dg + db * db) +
+                w.albedo * (da_r * da_r + da_g * da_g + da_b * da_b) +
+                w.normal * (dnx * dnx + dny * dny + dnz * dnz) +
+                w.depth * dz * dz;
+      e = e < w.cutoff ? e : w.cutoff;
+      float weight = h * fast_exp(-e);
+
+      sum_r[x] += weight * r;
+      sum_g[x] += weight * g;
+      sum_b[x] += weight * b;
+      sum_w[x] += weight;
+    }
+  }
+};
+
+#endif
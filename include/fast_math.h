@@ -0,0 +1,71 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <cmath>
+
+#include "common.h"
+
+// Approximations of the library functions on the shading paths. They are
+// polynomials without branches, so loops over batches of them vectorize
+// where calls into libm do not, given -fno-trapping-math to let the compiler
+// evaluate both sides of a select. One at a time they are still several
+// times faster than the library. Error bounds are the largest seen over
+// dense sweeps of the whole domain, against the double library function;
+// the fast_math_accuracy check repeats the sweeps.
+
+// x^5, as the Schlick Fresnel term uses it. Three multiplications instead of
+// the general pow(), and within a few ulp of it.
+template <typename T>
+inline T pow5(T x)
+{
+  T x2 = x * x;
+  return x2 * x2 * x;
+}
+
+// arccos(x) for x in [-1, 1], from Abramowitz and Stegun 4.4.46: absolute
+// error below 3e-8 in double, and 5e-7 in float, where rounding dominates.
+template <typename T>
+inline T fast_acos(T x)
+{
+  T a = std::fabs(x);
+  T p = T(-0.0012624911);
+  p = p * a + T(0.0066700901);
+  p = p * a - T(0.0170881256);
+  p = p * a + T(0.0308918810);
+  p = p * a - T(0.0501743046);
+  p = p * a + T(0.0889789874);
+  p = p * a - T(0.2145988016);
+  p = p * a + T(1.5707963050);
+  T r = std::sqrt(T(1) - a) * p;
+  return x < 0 ? T(pi) - r : r;
+}
+
+// atan2(y, x), in ]-pi, pi], with an absolute error below 1e-8 in double
+// and 3e-7 in float, and 0 for the origin. The ratio of the smaller to the
+// larger magnitude is reduced onto [0, tan(pi/8)], where a polynomial (the
+// one of Cephes' atanf) takes over.
+template <typename T>
+inline T fast_atan2(T y, T x)
+{
+  T ax = std::fabs(x), ay = std::fabs(y);
+  T hi = ax > ay ? ax : ay, lo = ax > ay ? ay : ax;
+  T t = lo / (hi > 0 ? hi : T(1));  // In [0, 1]
+
+  // atan(t) = pi/4 + atan((t - 1) / (t + 1))
+  bool reduce = t > T(0.41421356237309503);
+  T base = reduce ? T(pi / 4) : T(0);
+  t = reduce ? (t - 1) / (t + 1) : t;
+
+  T z = t * t;
+  T p = T(8.05374449538e-2);
+  p = p * z - T(1.38776856032e-1);
+  p = p * z + T(1.99777106478e-1);
+  p = p * z - T(3.33329491539e-1);
+  T r = base + (p * z * t + t);
+
+  r = ay > ax ? T(pi / 2) - r : r;
+  r = x < 0 ? T(pi) - r : r;
+  return y < 0 ? -r : r;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "color.h"
+#include "common.h"
+
+class framebuffer
+{
+ private:
+  int image_width = 0;
+  int image_height = 0;
+  std::vector<float> data;  // Linear RGB triplets, row-major from the top left
+
+  size_t offset(int x, int y) const
+  {
+    return 3 * (size_t(y) * image_width + x);
+  }
+
+ public:
+  framebuffer() {}
+  framebuffer(int width, int height)
+      : image_width(width),
+        image_height(height),
+        data(3 * size_t(width) * height, 0.0f)
+  {
+  }
+
+  int width() const { return image_width; }
+  int height() const { return image_height; }
+
+  const float* raw() const { return data.data(); }
+
+  color at(int x, int y) const
+  {
+    auto p = &data[offset(x, y)];
+    return color(p[0], p[1], p[2]);
+  }
+
+  void set(int x, int y, const color& c)
+  {
+    auto p = &data[offset(x, y)];
+    p[0] = float(c.x());
+    p[1] = float(c.y());
+    p[2] = float(c.z());
+  }
+
+  void add(int x, int y, const color& c)
+  {
+    auto p = &data[offset(x, y)];
+    p[0] += float(c.x());
+    p[1] += float(c.y());
+    p[2] += float(c.z());
+  }
+
+  std::vector<uint8_t> to_bytes() const
+  {
+    // Applies the gamma 2 transform and quantises every component to [0, 255]
+    // in a single pass over the buffer. The buffer is one flat float array, so
+    // the channels need no special handling and the loop runs four components
+    // per iteration.
+
+    size_t count = data.size();
+    std::vector<uint8_t> bytes(count);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 upper = _mm_set1_ps(0.999f);
+    const __m128 scale = _mm_set1_ps(256.0f);
+
+    for (; i + 16 <= count; i += 16)
+    {
+      __m128i lanes[4];
+      for (int k = 0; k < 4; k++)
+      {
+        // sqrt(max(x, 0)) matches linear_to_gamma(), which maps negatives to 0
+        __m128 v = _mm_loadu_ps(&data[i + 4 * k]);
+        v = _mm_sqrt_ps(_mm_max_ps(v, zero));
+        v = _mm_mul_ps(_mm_min_ps(v, upper), scale);
+        lanes[k] = _mm_cvttps_epi32(v);
+      }
+
+      __m128i lo = _mm_packs_epi32(lanes[0], lanes[1]);
+      __m128i hi = _mm_packs_epi32(lanes[2], lanes[3]);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&bytes[i]),
+                       _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    static const interval intensity(0.000, 0.999);
+    for (; i < count; i++)
+      bytes[i] = uint8_t(256 * intensity.clamp(linear_to_gamma(data[i])));
+
+    return bytes;
+  }
+};
+
+#endif
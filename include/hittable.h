@@ -1,8 +1,13 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
 #include "aabb.h"
 #include "common.h"
+#include "warp.h"
 
 class material;
 
@@ -11,25 +16,190 @@ class hit_record
  public:
   point3 p;
   vec3 normal;
-  shared_ptr<material> mat;
-  double u;
-  double v;
-  double t;
+  uint32_t mat_id;   // Index into material_table
+  uint32_t prim_id;  // Unique ID of the primitive that was hit
+  real u;
+  real v;
+  real t;
   bool front_face;
 
+  // For filtered texture lookups: the primitive sets how many uv units a
+  // unit of length on its surface spans, on average, and the integrator
+  // the width of the ray's footprint in uv units. 0 reads textures at the
+  // point.
+  real uv_density = 0;
+  real footprint = 0;
+
   void set_face_normal(const ray& r, const vec3& outward_normal)
   {
     front_face = dot(r.direction(), outward_normal) < 0;
     normal = front_face ? outward_normal : -outward_normal;
   }
+
+  // A ray leaving the surface towards `direction`. Its origin is p moved off
+  // the surface, to the side the ray leaves by, by a bound on the rounding
+  // error of p, so the ray cannot find the surface it starts on again. The
+  // bound grows with the coordinates: negligible in double precision, it is
+  // what keeps surfaces far from the origin free of acne in float.
+  ray spawn_ray(const vec3& direction, real time) const
+  {
+    const real gamma = 32 * std::numeric_limits<real>::epsilon();
+    auto error = gamma * (std::fabs(normal.x() * p.x()) +
+                          std::fabs(normal.y() * p.y()) +
+                          std::fabs(normal.z() * p.z()));
+    auto offset = dot(direction, normal) < 0 ? -error : error;
+    return ray(p + offset * normal, direction, time);
+  }
+};
+
+class hittable;
+
+struct ray_hit
+{
+  // The result of a distance-only intersection query: enough to find the
+  // closest hit, with the surface attributes left for the winner alone.
+  real t;
+  const hittable* object;  // Primitive that was hit, which finalizes it
+  uint32_t prim_id;
+
+  // Surface coordinates the primitive found while testing the hit, if any,
+  // kept so that finalizing need not recompute them.
+  real u;
+  real v;
+};
+
+struct ray_packet
+{
+  // Up to `size` rays traced together, such as the camera rays of a 4x4
+  // block of pixels. Lanes are in structure-of-arrays layout so primitives
+  // can test all of them with the same instructions, in loops the compiler
+  // turns into SIMD code.
+  //
+  // Each lane has its own interval, and tmax shrinks to the closest hit so
+  // far, just like the interval passed down a single-ray intersect().
+
+  static const int size = 16;
+  static const int side = 4;  // Camera packets cover side x side pixels
+
+  // Lanes outside `active` are zero, which primitives may test harmlessly.
+  alignas(64) real ox[size] = {}, oy[size] = {}, oz[size] = {};
+  alignas(64) real dx[size] = {}, dy[size] = {}, dz[size] = {};
+  alignas(64) real time[size] = {};
+  alignas(64) real tmin[size] = {}, tmax[size] = {};
+
+  ray_hit hits[size];
+  uint32_t active = 0;  // Lanes in use
+  uint32_t found = 0;   // Lanes with a hit in `hits`
+
+  void set(int k, const ray& r, interval ray_t)
+  {
+    ox[k] = r.origin().x();
+    oy[k] = r.origin().y();
+    oz[k] = r.origin().z();
+    dx[k] = r.direction().x();
+    dy[k] = r.direction().y();
+    dz[k] = r.direction().z();
+    time[k] = r.time();
+    tmin[k] = ray_t.min;
+    tmax[k] = ray_t.max;
+    active |= 1u << k;
+  }
+
+  ray get(int k) const
+  {
+    return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]),
+               time[k]);
+  }
+
+  interval range(int k) const { return interval(tmin[k], tmax[k]); }
+
+  void record(int k, const ray_hit& h)
+  {
+    hits[k] = h;
+    tmax[k] = h.t;
+    found |= 1u << k;
+  }
 };
 
+// Calls fn(k) for every lane k set in mask, lowest first.
+template <typename Fn>
+inline void for_each_lane(uint32_t mask, Fn fn)
+{
+  for (; mask; mask &= mask - 1) fn(__builtin_ctz(mask));
+}
+
 class hittable
 {
  public:
   virtual ~hittable() = default;
-  virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+  // Finds the closest hit within ray_t, filling in only its distance and the
+  // primitive it belongs to. Implementations write `hit` only when they
+  // return true.
+  virtual bool intersect(const ray& r, interval ray_t, ray_hit& hit) const = 0;
+
+  // Completes the surface attributes of a hit returned by this primitive's
+  // intersect(). Aggregates forward hits from their members, so only
+  // primitives are ever asked to finalize one.
+  virtual void finalize(const ray& r, const ray_hit& hit,
+                        hit_record& rec) const
+  {
+  }
+
+  // Returns whether anything blocks the ray within ray_t. Traversal may stop
+  // at the first hit found, in any order, and no surface attributes are
+  // computed, which makes this much cheaper than hit() for shadow rays.
+  virtual bool occluded(const ray& r, interval ray_t) const
+  {
+    ray_hit h;
+    return intersect(r, ray_t, h);
+  }
+
+  // Closest hits for the lanes of `mask`, within each lane's interval.
+  // Lanes that find a hit closer than their tmax record it in the packet.
+  // By default every lane is traced on its own; primitives and aggregates
+  // override this to share work across the lanes.
+  virtual void intersect_packet(ray_packet& packet, uint32_t mask) const
+  {
+    for_each_lane(mask, [&](int k) {
+      ray_hit h;
+      if (intersect(packet.get(k), packet.range(k), h)) packet.record(k, h);
+    });
+  }
+
   virtual aabb bounding_box() const = 0;
+
+  // Appends every primitive in this object whose material emits light, for
+  // the light list used by direct light sampling.
+  virtual void gather_emitters(std::vector<const hittable*>& emitters) const {}
+
+  // Surface area, or 0 for objects that cannot be sampled as area lights.
+  virtual double area() const { return 0; }
+
+  // Maps u uniformly onto the surface at the given time and fills in the
+  // position, outward normal, uv and material of the point. Only called when
+  // area() > 0.
+  virtual void sample_surface(real time, const sample2& u,
+                              hit_record& rec) const
+  {
+  }
+
+  // Closest hit with full surface attributes.
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const
+  {
+    ray_hit h;
+    if (!intersect(r, ray_t, h)) return false;
+    h.object->finalize(r, h, rec);
+    return true;
+  }
+
+ protected:
+  // Returns a new primitive ID, unique across the process.
+  static uint32_t new_primitive_id()
+  {
+    static std::atomic<uint32_t> next_id(0);
+    return next_id++;
+  }
 };
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include <vector>
+
 #include "common.h"
 #include "hittable.h"
 
@@ -23,28 +25,41 @@ class hittable_list : public hittable
     bbox = aabb(bbox, object->bounding_box());
   }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
   {
-    hit_record temp_rec;
+    // Objects only write the hit when they find one inside ray_t, so
+    // shrinking the interval to each hit leaves the closest one in place.
     bool hit_anything = false;
-    auto closest_so_far = ray_t.max;
 
     for (const auto& object : objects)
     {
-      if (object->hit(r, ray_t, temp_rec))
+      if (object->intersect(r, ray_t, hit))
       {
-        if (temp_rec.t < closest_so_far)
-        {
-          hit_anything = true;
-          closest_so_far = temp_rec.t;
-          rec = temp_rec;
-        }
+        hit_anything = true;
+        ray_t.max = hit.t;
       }
     }
     return hit_anything;
   }
 
+  void intersect_packet(ray_packet& packet, uint32_t mask) const override
+  {
+    for (const auto& object : objects) object->intersect_packet(packet, mask);
+  }
+
+  bool occluded(const ray& r, interval ray_t) const override
+  {
+    for (const auto& object : objects)
+      if (object->occluded(r, ray_t)) return true;
+    return false;
+  }
+
   aabb bounding_box() const override { return bbox; }
+
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
+  {
+    for (const auto& object : objects) object->gather_emitters(emitters);
+  }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#ifndef IMAGE_ENCODER_H
+#define IMAGE_ENCODER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "framebuffer.h"
+
+class image_encoder
+{
+ public:
+  virtual ~image_encoder() = default;
+
+  // File extension, without the dot, for images written by this encoder.
+  virtual std::string extension() const = 0;
+
+  // Writes the whole image to the given stream, which must be opened in binary
+  // mode. Returns false if the stream reported an error.
+  virtual bool write(std::ostream& out, const framebuffer& image) const = 0;
+};
+
+class ppm_encoder : public image_encoder
+{
+  // Binary (P6) PPM: a short text header followed by raw RGB bytes.
+
+ public:
+  std::string extension() const override { return "ppm"; }
+
+  bool write(std::ostream& out, const framebuffer& image) const override
+  {
+    auto bytes = image.to_bytes();
+
+    out << "P6\n" << image.width() << ' ' << image.height() << "\n255\n";
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+    return bool(out);
+  }
+};
+
+class pfm_encoder : public image_encoder
+{
+  // Portable float map: raw linear RGB floats, no gamma or clamping, so the
+  // full dynamic range of the render survives for later processing.
+
+ public:
+  std::string extension() const override { return "pfm"; }
+
+  bool write(std::ostream& out, const framebuffer& image) const override
+  {
+    // The sign of the scale gives the byte order of the samples, which we
+    // write in the host order.
+    const uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+
+    out << "PF\n" << image.width() << ' ' << image.height() << '\n'
+        << (little_endian ? "-1.0" : "1.0") << '\n';
+
+    // PFM stores scanlines bottom to top.
+    auto row_bytes = 3 * sizeof(float) * size_t(image.width());
+    for (int j = image.height() - 1; j >= 0; j--)
+    {
+      auto row = image.raw() + 3 * size_t(j) * image.width();
+      out.write(reinterpret_cast<const char*>(row), row_bytes);
+    }
+
+    return bool(out);
+  }
+};
+
+class png_encoder : public image_encoder
+{
+  // 8-bit RGB PNG. The zlib stream uses stored (uncompressed) deflate blocks,
+  // which keeps the writer tiny and as fast as a memcpy; the files are about
+  // the size of a P6 PPM but open in any image viewer.
+
+ private:
+  static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+  {
+    static const auto table = [] {
+      std::vector<uint32_t> t(256);
+      for (uint32_t n = 0; n < 256; n++)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        t[n] = c;
+      }
+      return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  static void put_u32(std::vector<uint8_t>& out, uint32_t value)
+  {
+    // PNG integers are big-endian.
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+  }
+
+  static void write_chunk(std::ostream& out, const char* type,
+                          const std::vector<uint8_t>& payload)
+  {
+    std::vector<uint8_t> chunk;
+    chunk.reserve(payload.size() + 12);
+    put_u32(chunk, uint32_t(payload.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    put_u32(chunk, crc32(chunk.data() + 4, payload.size() + 4));
+
+    out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+  }
+
+  static uint32_t adler32(const std::vector<uint8_t>& data)
+  {
+    // 5552 is the longest run of bytes for which the sums cannot overflow 32
+    // bits, so the modulo is only needed once per run.
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < data.size();)
+    {
+      size_t end = std::min(data.size(), pos + 5552);
+      for (; pos < end; pos++)
+      {
+        a += data[pos];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  static std::vector<uint8_t> zlib_store(const std::vector<uint8_t>& raw)
+  {
+    const size_t max_block = 65535;
+    size_t block_count = raw.size() / max_block + 1;
+
+    std::vector<uint8_t> z;
+    z.reserve(raw.size() + 5 * block_count + 6);
+
+    // zlib header: deflate with a 32K window, no preset dictionary, and the
+    // check bits making the 16-bit header a multiple of 31.
+    z.push_back(0x78);
+    z.push_back(0x01);
+
+    size_t pos = 0;
+    do
+    {
+      size_t len = std::min(max_block, raw.size() - pos);
+      bool last = pos + len == raw.size();
+
+      z.push_back(last ? 1 : 0);  // BFINAL, BTYPE=00 (stored)
+      z.push_back(uint8_t(len));
+      z.push_back(uint8_t(len >> 8));
+      z.push_back(uint8_t(~len));
+      z.push_back(uint8_t(~len >> 8));
+      z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+      pos += len;
+    } while (pos < raw.size());
+
+    put_u32(z, adler32(raw));
+    return z;
+  }
+
+ public:
+  std::string extension() const override { return "png"; }
+
+  bool write(std::ostream& out, const framebuffer& image) const override
+  {
+    static const uint8_t signature[] = {0x89, 'P',  'N',  'G',
+                                        '\r', '\n', 0x1a, '\n'};
+    out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<uint8_t> header;
+    put_u32(header, uint32_t(image.width()));
+    put_u32(header, uint32_t(image.height()));
+    header.push_back(8);  // Bit depth
+    header.push_back(2);  // Colour type: truecolour RGB
+    header.push_back(0);  // Compression method: deflate
+    header.push_back(0);  // Filter method: adaptive
+    header.push_back(0);  // Interlace method: none
+    write_chunk(out, "IHDR", header);
+
+    // Each scanline is prefixed with its filter type, 0 (none).
+    auto bytes = image.to_bytes();
+    auto row_bytes = 3 * size_t(image.width());
+    std::vector<uint8_t> raw;
+    raw.reserve((row_bytes + 1) * image.height());
+    for (int j = 0; j < image.height(); j++)
+    {
+      raw.push_back(0);
+      auto row = bytes.begin() + j * row_bytes;
+      raw.insert(raw.end(), row, row + row_bytes);
+    }
+
+    write_chunk(out, "IDAT", zlib_store(raw));
+    write_chunk(out, "IEND", {});
+
+    return bool(out);
+  }
+};
+
+#endif
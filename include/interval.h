@@ -6,11 +6,11 @@
 class interval
 {
  public:
-  double min, max;
+  real min, max;
 
   interval() : min(infinity), max(-infinity) {}  // Defaults to empty interval
 
-  interval(double min, double max) : min(min), max(max) {}
+  interval(real min, real max) : min(min), max(max) {}
 
   interval(const interval& a, const interval& b)
   {
@@ -19,20 +19,20 @@ class interval
     max = a.max >= b.max ? a.max : b.max;
   }
 
-  double size() const { return max - min; }
+  real size() const { return max - min; }
 
-  bool contains(double x) const { return (min <= x && x <= max); }
+  bool contains(real x) const { return (min <= x && x <= max); }
 
-  bool surrounds(double x) const { return (min < x && x < max); }
+  bool surrounds(real x) const { return (min < x && x < max); }
 
-  double clamp(double x) const
+  real clamp(real x) const
   {
     if (x < min) return min;
     if (x > max) return max;
     return x;
   }
 
-  interval expand(double delta) const
+  interval expand(real delta) const
   {
     auto padding = delta / 2;
     return interval(min - padding, max + padding);
@@ -0,0 +1,127 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include <algorithm>
+#include <vector>
+
+#include "hittable.h"
+
+struct light_sample
+{
+  hit_record point;  // The point on the light, with its outward normal
+  vec3 direction;    // Unit vector from the shaded point towards the light
+  double distance;   // Distance to the sampled point
+  double pdf;        // Density per unit solid angle at the shaded point
+};
+
+class light_list
+{
+  // Every emissive primitive of a scene, for next-event estimation. A light
+  // is chosen with probability proportional to its area and a point uniformly
+  // over its surface, so every point on every light is picked with the same
+  // area density, 1 / total_area.
+  //
+  // The list points into the scene, which must outlive it.
+
+ private:
+  std::vector<const hittable*> lights;
+  std::vector<double> cdf;  // Running sum of the light areas
+  double total_area = 0;
+
+  static double solid_angle_pdf(double distance, double cos_light,
+                                double total_area)
+  {
+    // Converts the area density 1 / total_area to solid angle. Lights emit
+    // from both faces, so either side of the surface counts.
+    cos_light = std::fabs(cos_light);
+    if (cos_light < 1e-8) return 0;
+    return distance * distance / (cos_light * total_area);
+  }
+
+ public:
+  light_list() {}
+
+  light_list(const hittable& world)
+  {
+    std::vector<const hittable*> emitters;
+    world.gather_emitters(emitters);
+
+    for (auto light : emitters)
+    {
+      auto area = light->area();
+      if (area <= 0) continue;
+
+      total_area += area;
+      lights.push_back(light);
+      cdf.push_back(total_area);
+    }
+  }
+
+  bool empty() const { return lights.empty(); }
+  size_t size() const { return lights.size(); }
+
+  // Maps u to a point on the lights as seen from `origin`. Returns false if
+  // the sample cannot contribute, e.g. a point seen exactly edge-on.
+  bool sample(const point3& origin, double time, const sample2& u,
+              light_sample& s) const
+  {
+    if (lights.empty()) return false;
+
+    // u.x picks the light, then is stretched back over [0, 1[ within the
+    // light's share, so it can place the point too.
+    auto target = u.x * total_area;
+    auto k = std::min(size_t(std::upper_bound(cdf.begin(), cdf.end(), target) -
+                             cdf.begin()),
+                      lights.size() - 1);
+    auto low = k > 0 ? cdf[k - 1] : 0.0;
+    auto x = std::clamp((target - low) / (cdf[k] - low), 0.0,
+                        0x1.fffffffffffffp-1);
+    lights[k]->sample_surface(time, {x, u.y}, s.point);
+
+    auto to_light = s.point.p - origin;
+    s.distance = to_light.length();
+    if (s.distance <= 0) return false;
+    s.direction = to_light / s.distance;
+
+    s.pdf = solid_angle_pdf(s.distance, dot(s.point.normal, s.direction),
+                            total_area);
+    return s.pdf > 0;
+  }
+
+  // Density with which sample() would have picked the light point that `r`
+  // reached, described by `rec`.
+  double pdf(const ray& r, const hit_record& rec) const
+  {
+    if (lights.empty()) return 0;
+
+    auto length = r.direction().length();
+    return solid_angle_pdf(rec.t * length,
+                           dot(rec.normal, r.direction()) / length,
+                           total_area);
+  }
+
+  // Density with which sample() picks `direction` from `origin`: the sum over
+  // every light point along the direction, hidden or not.
+  double pdf_value(const point3& origin, const vec3& direction,
+                   double time) const
+  {
+    ray r(origin, unit_vector(direction), time);
+    double density = 0;
+
+    for (auto light : lights)
+    {
+      interval ray_t(0.001, infinity);
+      ray_hit h;
+      while (light->intersect(r, ray_t, h))
+      {
+        hit_record rec;
+        light->finalize(r, h, rec);
+        density += pdf(r, rec);
+        ray_t.min = h.t + 0.001;
+      }
+    }
+    return density;
+  }
+};
+
+#endif
@@ -0,0 +1,520 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "bvh_builder.h"
+#include "bvh_stats.h"
+#include "hittable_list.h"
+
+struct linear_bvh_node
+{
+  // Bounds are stored in single precision, rounded outwards so that the float
+  // box always contains the double one.
+  float bounds_min[3];
+  float bounds_max[3];
+
+  // Leaf: index of the first primitive. Interior: index of the second child;
+  // the first child always directly follows its parent in the array.
+  uint32_t offset;
+  uint16_t prim_count;  // 0 for interior nodes
+  uint8_t axis;         // Split axis of an interior node
+  uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32,
+              "BVH nodes should fill exactly half a cache line");
+
+class linear_bvh : public hittable
+{
+  // A BVH compiled into one contiguous array of nodes in depth-first order.
+  // Traversal is an explicit loop with a small stack, with no virtual calls or
+  // pointer chasing between nodes, and at each interior node it visits the
+  // child on the near side of the split first, so a closer hit is found early
+  // and shrinks the interval used to cull the far child.
+
+ private:
+  static const int stack_size = 64;
+
+  // Packets whose live lanes drop to this many test primitives ray by ray.
+  static const int scalar_lanes = 4;
+
+  std::vector<linear_bvh_node> nodes;
+  std::vector<shared_ptr<hittable>> primitives;  // Ordered by leaf
+  aabb bbox;
+  bvh_build_stats stats;
+
+  struct build_output
+  {
+    std::vector<linear_bvh_node> nodes;
+    std::vector<uint32_t> prim_order;  // Source list indices, in leaf order
+    bvh_build_stats stats;
+
+    void append(const build_output& subtree)
+    {
+      // Moves a separately built subtree to the end of this one, relocating
+      // its child and primitive offsets.
+      auto node_base = uint32_t(nodes.size());
+      auto prim_base = uint32_t(prim_order.size());
+      for (auto node : subtree.nodes)
+      {
+        node.offset += node.prim_count > 0 ? prim_base : node_base;
+        nodes.push_back(node);
+      }
+      prim_order.insert(prim_order.end(), subtree.prim_order.begin(),
+                        subtree.prim_order.end());
+
+      stats.leaf_count += subtree.stats.leaf_count;
+      stats.sah_cost += subtree.stats.sah_cost;
+      stats.max_depth = std::max(stats.max_depth, subtree.stats.max_depth);
+    }
+  };
+
+  // With a build pool, ranges at least this large build their two subtrees
+  // as parallel tasks. Smaller ones aren't worth the merge copy.
+  static const size_t fork_threshold = 4096;
+
+  uint32_t build(const bvh_builder& builder, std::vector<bvh_primitive>& prims,
+                 size_t start, size_t end, int depth, build_output& out,
+                 thread_pool* pool) const
+  {
+    // Appends the subtree over prims[start, end) in depth-first order and
+    // returns the index of its root.
+
+    aabb bounds = bvh_builder::bounds_of(prims, start, end, pool);
+
+    auto node_index = uint32_t(out.nodes.size());
+    out.nodes.emplace_back();
+    for (int a = 0; a < 3; a++)
+    {
+      out.nodes[node_index].bounds_min[a] =
+          round_down(bounds.axis_interval(a).min);
+      out.nodes[node_index].bounds_max[a] =
+          round_up(bounds.axis_interval(a).max);
+    }
+
+    out.stats.max_depth = std::max(out.stats.max_depth, depth);
+    auto weight = bvh_builder::relative_area(bounds, bbox);
+
+    int axis;
+    auto mid = builder.split(prims, start, end, bounds, depth, axis, pool);
+
+    if (mid == start)
+    {
+      size_t count = end - start;
+      out.nodes[node_index].offset = uint32_t(out.prim_order.size());
+      out.nodes[node_index].prim_count = uint16_t(count);
+      for (size_t i = start; i < end; i++)
+        out.prim_order.push_back(prims[i].index);
+
+      out.stats.leaf_count++;
+      out.stats.sah_cost += weight * builder.leaf_cost(count);
+      return node_index;
+    }
+
+    uint32_t second;
+    if (pool && end - start >= fork_threshold)
+    {
+      // The halves are disjoint ranges of prims, so they can be partitioned
+      // concurrently; each builds into its own arrays, spliced in afterwards.
+      build_output halves[2];
+      pool->parallel_for(2, [&](int side, int) {
+        if (side == 0)
+          build(builder, prims, start, mid, depth + 1, halves[0], pool);
+        else
+          build(builder, prims, mid, end, depth + 1, halves[1], pool);
+      });
+
+      out.append(halves[0]);
+      second = uint32_t(out.nodes.size());
+      out.append(halves[1]);
+    }
+    else
+    {
+      build(builder, prims, start, mid, depth + 1, out, pool);
+      second = build(builder, prims, mid, end, depth + 1, out, pool);
+    }
+
+    out.nodes[node_index].offset = second;
+    out.nodes[node_index].prim_count = 0;
+    out.nodes[node_index].axis = uint8_t(axis);
+
+    out.stats.sah_cost += weight * builder.options.traversal_cost;
+    return node_index;
+  }
+
+  struct packet_bounds
+  {
+    // Interval-arithmetic bounds of a ray packet: the range of its origins
+    // and reciprocal directions on each axis, and of its intervals. Valid
+    // only when the directions of all lanes share signs on every axis.
+    real origin_min[3], origin_max[3];
+    real inv_min[3], inv_max[3];
+    real t_min, t_max;
+    bool coherent = true;
+    bool negative[3];  // Majority direction sign, for ordering children
+
+    packet_bounds(const ray_packet& packet, uint32_t mask,
+                  const real* const origin[3],
+                  real (*inv)[ray_packet::size])
+    {
+      t_min = infinity;
+      t_max = -infinity;
+      for (int a = 0; a < 3; a++)
+      {
+        origin_min[a] = inv_min[a] = infinity;
+        origin_max[a] = inv_max[a] = -infinity;
+      }
+
+      int negatives[3] = {0, 0, 0}, lanes = 0;
+      for_each_lane(mask, [&](int k) {
+        lanes++;
+        t_min = std::fmin(t_min, packet.tmin[k]);
+        t_max = std::fmax(t_max, packet.tmax[k]);
+        for (int a = 0; a < 3; a++)
+        {
+          origin_min[a] = std::fmin(origin_min[a], origin[a][k]);
+          origin_max[a] = std::fmax(origin_max[a], origin[a][k]);
+          inv_min[a] = std::fmin(inv_min[a], inv[a][k]);
+          inv_max[a] = std::fmax(inv_max[a], inv[a][k]);
+          negatives[a] += inv[a][k] < 0;
+        }
+      });
+
+      for (int a = 0; a < 3; a++)
+      {
+        negative[a] = 2 * negatives[a] > lanes;
+        if (negatives[a] != 0 && negatives[a] != lanes) coherent = false;
+        if (!std::isfinite(inv_min[a]) || !std::isfinite(inv_max[a]))
+          coherent = false;
+      }
+    }
+
+    bool may_hit(const linear_bvh_node& node) const
+    {
+      // Conservative: false only if no ray of the packet can enter the box.
+      // The slab distances of every lane lie in the product of the interval
+      // from the box plane to the origins with the reciprocal directions.
+      if (!coherent) return true;
+
+      real t_enter = t_min, t_exit = t_max;
+      for (int a = 0; a < 3; a++)
+      {
+        real near_plane = inv_min[a] < 0 ? node.bounds_max[a]
+                                           : node.bounds_min[a];
+        real far_plane = inv_min[a] < 0 ? node.bounds_min[a]
+                                          : node.bounds_max[a];
+        t_enter = std::fmax(t_enter, product_min(near_plane - origin_max[a],
+                                                 near_plane - origin_min[a],
+                                                 a));
+        t_exit = std::fmin(t_exit, product_max(far_plane - origin_max[a],
+                                               far_plane - origin_min[a], a));
+      }
+      return t_enter <= t_exit;
+    }
+
+   private:
+    real product_min(real lo, real hi, int a) const
+    {
+      return std::fmin(std::fmin(lo * inv_min[a], lo * inv_max[a]),
+                       std::fmin(hi * inv_min[a], hi * inv_max[a]));
+    }
+
+    real product_max(real lo, real hi, int a) const
+    {
+      return std::fmax(std::fmax(lo * inv_min[a], lo * inv_max[a]),
+                       std::fmax(hi * inv_min[a], hi * inv_max[a]));
+    }
+  };
+
+  static bool hit_node(const linear_bvh_node& node, const point3& origin,
+                       const vec3& inv_dir, interval ray_t)
+  {
+    for (int axis = 0; axis < 3; axis++)
+    {
+      auto t0 = (node.bounds_min[axis] - origin[axis]) * inv_dir[axis];
+      auto t1 = (node.bounds_max[axis] - origin[axis]) * inv_dir[axis];
+
+      if (t0 < t1)
+      {
+        if (t0 > ray_t.min) ray_t.min = t0;
+        if (t1 < ray_t.max) ray_t.max = t1;
+      }
+      else
+      {
+        if (t1 > ray_t.min) ray_t.min = t1;
+        if (t0 < ray_t.max) ray_t.max = t0;
+      }
+
+      if (ray_t.max <= ray_t.min) return false;
+    }
+    return true;
+  }
+
+ public:
+  // Single precision bounds on a double, for conversions that must stay
+  // conservative.
+  static float round_down(double x)
+  {
+    auto f = float(x);
+    return double(f) > x ? std::nextafter(f, -INFINITY) : f;
+  }
+
+  static float round_up(double x)
+  {
+    auto f = float(x);
+    return double(f) < x ? std::nextafter(f, INFINITY) : f;
+  }
+
+  linear_bvh(const hittable_list& list,
+             bvh_build_options options = bvh_build_options())
+  {
+    const auto& objects = list.objects;
+    if (objects.empty()) return;
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Leaf sizes are stored in 16 bits.
+    options.max_leaf_size = std::clamp(options.max_leaf_size, 1, 65535);
+    bvh_builder builder(options);
+
+    std::unique_ptr<thread_pool> pool;
+    if (options.thread_count != 1)
+      pool = std::make_unique<thread_pool>(options.thread_count);
+
+    auto prims = bvh_builder::make_primitives(objects, pool.get());
+    bbox = bvh_builder::bounds_of(prims, 0, prims.size(), pool.get());
+
+    build_output out;
+    out.nodes.reserve(2 * objects.size());
+    out.prim_order.reserve(objects.size());
+    build(builder, prims, 0, prims.size(), 0, out, pool.get());
+
+    nodes = std::move(out.nodes);
+    nodes.shrink_to_fit();
+    primitives.reserve(out.prim_order.size());
+    for (auto index : out.prim_order) primitives.push_back(objects[index]);
+
+    stats = out.stats;
+    stats.node_count = nodes.size();
+    stats.build_ms = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+  }
+
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
+  {
+    if (nodes.empty()) return false;
+
+    const point3& origin = r.origin();
+    const vec3& dir = r.direction();
+    vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+    bool dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    bvh_stats::ray();
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true)
+    {
+      const auto& node = nodes[current];
+      bvh_stats::visit(&node);
+
+      if (hit_node(node, origin, inv_dir, ray_t))
+      {
+        if (node.prim_count > 0)
+        {
+          for (uint32_t i = 0; i < node.prim_count; i++)
+          {
+            if (primitives[node.offset + i]->intersect(r, ray_t, hit))
+            {
+              hit_anything = true;
+              ray_t.max = hit.t;
+            }
+          }
+        }
+        else
+        {
+          // Descend into the near child and defer the far one. Children are
+          // split along node.axis, the first holding the smaller centroids, so
+          // a ray heading down that axis usually meets the second child first.
+          if (dir_is_neg[node.axis])
+          {
+            stack[stack_top++] = current + 1;
+            current = node.offset;
+          }
+          else
+          {
+            stack[stack_top++] = node.offset;
+            current = current + 1;
+          }
+          continue;
+        }
+      }
+
+      if (stack_top == 0) break;
+      current = stack[--stack_top];
+    }
+
+    return hit_anything;
+  }
+
+  bool occluded(const ray& r, interval ray_t) const override
+  {
+    // Any hit will do, so children are visited in array order and the search
+    // stops at the first primitive that blocks the ray.
+    if (nodes.empty()) return false;
+
+    const point3& origin = r.origin();
+    const vec3& dir = r.direction();
+    vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+    bvh_stats::ray();
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+
+    while (true)
+    {
+      const auto& node = nodes[current];
+      bvh_stats::visit(&node);
+
+      if (hit_node(node, origin, inv_dir, ray_t))
+      {
+        if (node.prim_count == 0)
+        {
+          stack[stack_top++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+
+        for (uint32_t i = 0; i < node.prim_count; i++)
+          if (primitives[node.offset + i]->occluded(r, ray_t)) return true;
+      }
+
+      if (stack_top == 0) return false;
+      current = stack[--stack_top];
+    }
+  }
+
+  void intersect_packet(ray_packet& packet, uint32_t mask) const override
+  {
+    // The packet walks the tree as one, after Wald et al.'s coherent ray
+    // tracing. Its mask drops the leading lanes known to miss: a node is
+    // entered as soon as one lane hits it, testing lanes in order, so a
+    // coherent packet usually pays for a single ray test per node. Before
+    // that, interval arithmetic over the whole packet culls nodes that no
+    // lane can reach. Leaves hand all the remaining lanes to the primitives'
+    // lane loops, without testing the leaf box lane by lane.
+    if (nodes.empty() || !mask) return;
+
+    const int n = ray_packet::size;
+    alignas(64) real inv[3][n];
+    const real* origin[3] = {packet.ox, packet.oy, packet.oz};
+    const real* dir[3] = {packet.dx, packet.dy, packet.dz};
+    for (int a = 0; a < 3; a++)
+      for (int k = 0; k < n; k++) inv[a][k] = 1 / dir[a][k];
+
+    packet_bounds bounds(packet, mask, origin, inv);
+
+    auto lane_enters = [&](const linear_bvh_node& node, int k) {
+      return hit_node(node, point3(origin[0][k], origin[1][k], origin[2][k]),
+                      vec3(inv[0][k], inv[1][k], inv[2][k]), packet.range(k));
+    };
+
+    struct entry
+    {
+      uint32_t node;
+      uint32_t mask;
+    };
+    entry stack[stack_size];
+    int stack_top = 0;
+    entry current = {0, mask};
+    for_each_lane(mask, [](int) { bvh_stats::ray(); });
+
+    while (true)
+    {
+      const auto& node = nodes[current.node];
+      bvh_stats::visit(&node);
+
+      // Skip to the first lane that enters the node, if any. The packet test
+      // only pays off once the leading lane has missed.
+      uint32_t live = current.mask;
+      if (!lane_enters(node, __builtin_ctz(live)))
+      {
+        live = bounds.may_hit(node) ? live & (live - 1) : 0;
+        while (live && !lane_enters(node, __builtin_ctz(live)))
+          live &= live - 1;
+      }
+
+      if (live)
+      {
+        if (node.prim_count > 0)
+        {
+          // Once few lanes are left, testing all of them costs more than
+          // tracing the survivors one at a time.
+          bool divergent = __builtin_popcount(live) <= scalar_lanes;
+          for (uint32_t i = 0; i < node.prim_count; i++)
+          {
+            const auto& primitive = primitives[node.offset + i];
+            if (divergent)
+              primitive->hittable::intersect_packet(packet, live);
+            else
+              primitive->intersect_packet(packet, live);
+          }
+        }
+        else
+        {
+          // Near child first, by the packet's majority direction sign.
+          if (bounds.negative[node.axis])
+          {
+            stack[stack_top++] = {current.node + 1, live};
+            current = {node.offset, live};
+          }
+          else
+          {
+            stack[stack_top++] = {node.offset, live};
+            current = {current.node + 1, live};
+          }
+          continue;
+        }
+      }
+
+      if (stack_top == 0) break;
+      current = stack[--stack_top];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
+  {
+    for (const auto& primitive : primitives)
+      primitive->gather_emitters(emitters);
+  }
+
+  const bvh_build_stats& build_stats() const { return stats; }
+
+  // The compiled tree, for converting into other node layouts.
+  const std::vector<linear_bvh_node>& node_array() const { return nodes; }
+  const std::vector<shared_ptr<hittable>>& primitive_array() const
+  {
+    return primitives;
+  }
+
+  size_t memory_bytes() const
+  {
+    return nodes.size() * sizeof(linear_bvh_node) +
+           primitives.size() * sizeof(shared_ptr<hittable>);
+  }
+};
+
+#endif
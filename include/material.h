@@ -2,24 +2,72 @@
 #define MATERIAL_H
 
 #include "common.h"
+#include "fast_math.h"
 #include "hittable.h"
+#include "pdf.h"
 #include "texture.h"
 
+struct scatter_record
+{
+  // One sampled continuation of a path at a surface.
+  ray scattered;
+
+  // BSDF value times the cosine to the normal, for the scattered direction.
+  color bsdf;
+
+  // Density with which the direction was picked, per unit solid angle. 0
+  // marks a specular direction, picked deterministically or from a discrete
+  // choice, for which `bsdf` is already the weight of the path.
+  double pdf;
+
+  bool is_specular() const { return pdf == 0; }
+};
+
 class material
 {
  public:
   virtual ~material() = default;
 
-  virtual color emitted(double u, double v, const point3& p) const
+  // Radiance leaving the surface, filtered over `footprint` uv units like a
+  // texture::value() lookup.
+  virtual color emitted(double u, double v, const point3& p,
+                        double footprint) const
   {
     return color(0, 0, 0);
   }
 
-  virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation,
-                       ray& scattered) const
+  // Maps u to a scattered direction with its density and BSDF value. Returns
+  // false if the path is absorbed.
+  virtual bool scatter(const ray& r_in, const hit_record& rec,
+                       const sample2& u, scatter_record& srec) const
   {
     return false;
   }
+
+  // BSDF value times the cosine to the normal for light arriving from
+  // `direction`. Specular materials return 0: no other direction reaches them.
+  virtual color eval(const ray& r_in, const hit_record& rec,
+                     const vec3& direction) const
+  {
+    return color(0, 0, 0);
+  }
+
+  // Density, per unit solid angle, with which scatter() picks the given
+  // direction, or 0 for specular materials, which also keeps direct light
+  // sampling away from them.
+  virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                const vec3& direction) const
+  {
+    return 0;
+  }
+
+  // Whether emitted() can be non-zero, making surfaces of this material
+  // lights for direct light sampling.
+  virtual bool is_emissive() const { return false; }
+
+  // Overall reflectance at the hit, a feature image for the denoiser. Glass
+  // and lights, which have no color of their own, report white.
+  virtual color albedo(const hit_record& rec) const { return color(1, 1, 1); }
 };
 
 class lambertian : public material
@@ -30,41 +78,183 @@ class lambertian : public material
  public:
   lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
   lambertian(shared_ptr<texture> tex) : tex(tex) {}
-  bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
-               ray& scattered) const override
+
+  bool scatter(const ray& r_in, const hit_record& rec, const sample2& u,
+               scatter_record& srec) const override
   {
-    (void) r_in;  // Unused
+    cosine_pdf distribution(rec.normal);
+    auto direction = distribution.generate(u);
 
-    vec3 scatter_direction = rec.normal + random_unit_vector();
-    if (scatter_direction.near_zero())
-    {
-      scatter_direction = rec.normal;
-    }
+    srec.scattered = rec.spawn_ray(direction, r_in.time());
+    srec.pdf = distribution.value(direction);
+    srec.bsdf = tex->value(rec.u, rec.v, rec.p, rec.footprint) * srec.pdf;
 
-    scattered = ray(rec.p, scatter_direction, r_in.time());
-    attenuation = tex->value(rec.u, rec.v, rec.p);
+    return srec.pdf > 0;
+  }
 
-    return true;
+  color eval(const ray& r_in, const hit_record& rec,
+             const vec3& direction) const override
+  {
+    return tex->value(rec.u, rec.v, rec.p, rec.footprint) *
+           scattering_pdf(r_in, rec, direction);
+  }
+
+  double scattering_pdf(const ray& r_in, const hit_record& rec,
+                        const vec3& direction) const override
+  {
+    // albedo / pi * cos(theta), sampled exactly in proportion.
+    return cosine_pdf(rec.normal).value(direction);
+  }
+
+  color albedo(const hit_record& rec) const override
+  {
+    return tex->value(rec.u, rec.v, rec.p, rec.footprint);
   }
 };
 
 class metal : public material
 {
+  // A conductor: a mirror when fuzz is 0, otherwise a GGX microfacet surface
+  // with roughness alpha = fuzz and Schlick Fresnel tinted by the albedo.
+
  private:
-  color albedo;
+  color tint;  // Reflectance at normal incidence
   double fuzz;
 
+  color fresnel(double cosine) const
+  {
+    return tint + (color(1, 1, 1) - tint) * pow5(1 - cosine);
+  }
+
+ public:
+  metal(const color& albedo, double fuzz)
+      : tint(albedo), fuzz(std::fmin(fuzz, 1))
+  {
+  }
+
+  bool scatter(const ray& r_in, const hit_record& rec, const sample2& u,
+               scatter_record& srec) const override
+  {
+    auto wo = -unit_vector(r_in.direction());
+
+    if (fuzz <= 0)
+    {
+      srec.scattered = rec.spawn_ray(reflect(-wo, rec.normal), r_in.time());
+      srec.bsdf = tint;
+      srec.pdf = 0;
+      return true;
+    }
+
+    ggx_pdf distribution(rec.normal, wo, fuzz);
+    auto direction = distribution.generate(u);
+    if (dot(direction, rec.normal) <= 0) return false;
+
+    srec.scattered = rec.spawn_ray(direction, r_in.time());
+    srec.pdf = distribution.value(direction);
+    srec.bsdf = eval(r_in, rec, direction);
+    return srec.pdf > 0;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec,
+             const vec3& direction) const override
+  {
+    if (fuzz <= 0) return color(0, 0, 0);
+
+    auto wo = -unit_vector(r_in.direction());
+    auto wi = unit_vector(direction);
+    auto cos_o = dot(wo, rec.normal), cos_i = dot(wi, rec.normal);
+    if (cos_o <= 0 || cos_i <= 0) return color(0, 0, 0);
+
+    auto h = unit_vector(wo + wi);
+    auto d = ggx_pdf::distribution(dot(h, rec.normal), fuzz);
+    auto g = ggx_pdf::masking(cos_o, fuzz) * ggx_pdf::masking(cos_i, fuzz);
+
+    // D G F / (4 cos_o cos_i), times cos_i.
+    return fresnel(std::fmax(0.0, dot(wi, h))) * (d * g / (4 * cos_o));
+  }
+
+  double scattering_pdf(const ray& r_in, const hit_record& rec,
+                        const vec3& direction) const override
+  {
+    if (fuzz <= 0) return 0;
+    return ggx_pdf(rec.normal, -unit_vector(r_in.direction()), fuzz)
+        .value(direction);
+  }
+
+  color albedo(const hit_record& rec) const override { return tint; }
+};
+
+class glossy : public material
+{
+  // A diffuse base under a clear varnish, like plastic or lacquered wood. The
+  // coat reflects a Fresnel share of the light off a GGX surface with
+  // roughness alpha; the rest reaches the base. Directions are sampled from a
+  // mixture of both lobes.
+
+ private:
+  shared_ptr<texture> tex;
+  double alpha;
+
+  static double fresnel(double cosine)
+  {
+    // Schlick, with the 4% normal reflectance of a typical varnish.
+    const double f0 = 0.04;
+    return f0 + (1 - f0) * pow5(1 - cosine);
+  }
+
  public:
-  metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz) {}
-  bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
-               ray& scattered) const override
+  glossy(const color& albedo, double alpha)
+      : tex(make_shared<solid_color>(albedo)), alpha(alpha)
+  {
+  }
+  glossy(shared_ptr<texture> tex, double alpha) : tex(tex), alpha(alpha) {}
+
+  bool scatter(const ray& r_in, const hit_record& rec, const sample2& u,
+               scatter_record& srec) const override
   {
-    vec3 reflected = reflect(r_in.direction(), rec.normal);
-    reflected = unit_vector(reflected) + random_unit_vector() * fuzz;
-    scattered = ray(rec.p, reflected, r_in.time());
-    attenuation = albedo;
+    auto wo = -unit_vector(r_in.direction());
+    cosine_pdf diffuse(rec.normal);
+    ggx_pdf coat(rec.normal, wo, alpha);
+    mixture_pdf distribution(diffuse, coat);
+
+    auto direction = distribution.generate(u);
+    if (dot(direction, rec.normal) <= 0) return false;
 
-    return dot(scattered.direction(), rec.normal) > 0;
+    srec.scattered = rec.spawn_ray(direction, r_in.time());
+    srec.pdf = distribution.value(direction);
+    srec.bsdf = eval(r_in, rec, direction);
+    return srec.pdf > 0;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec,
+             const vec3& direction) const override
+  {
+    auto wo = -unit_vector(r_in.direction());
+    auto wi = unit_vector(direction);
+    auto cos_o = dot(wo, rec.normal), cos_i = dot(wi, rec.normal);
+    if (cos_o <= 0 || cos_i <= 0) return color(0, 0, 0);
+
+    auto h = unit_vector(wo + wi);
+    auto d = ggx_pdf::distribution(dot(h, rec.normal), alpha);
+    auto g = ggx_pdf::masking(cos_o, alpha) * ggx_pdf::masking(cos_i, alpha);
+    auto specular = fresnel(std::fmax(0.0, dot(wi, h))) * d * g / (4 * cos_o);
+
+    auto base =
+        tex->value(rec.u, rec.v, rec.p, rec.footprint) * (cos_i / pi);
+    return (1 - fresnel(cos_o)) * base + color(specular, specular, specular);
+  }
+
+  double scattering_pdf(const ray& r_in, const hit_record& rec,
+                        const vec3& direction) const override
+  {
+    cosine_pdf diffuse(rec.normal);
+    ggx_pdf coat(rec.normal, -unit_vector(r_in.direction()), alpha);
+    return mixture_pdf(diffuse, coat).value(direction);
+  }
+
+  color albedo(const hit_record& rec) const override
+  {
+    return tex->value(rec.u, rec.v, rec.p, rec.footprint);
   }
 };
 
@@ -77,16 +267,19 @@ class dielectric : public material
   {
     auto r0 = (1 - refraction_index) / (1 + refraction_index);
     r0 = r0 * r0;
-    return r0 + (1 - r0) * std::pow((1 - cosine), 5);
+    return r0 + (1 - r0) * pow5(1 - cosine);
   }
 
  public:
   dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-  bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
-               ray& scattered) const override
+  bool scatter(const ray& r_in, const hit_record& rec, const sample2& u,
+               scatter_record& srec) const override
   {
-    attenuation = color(1.0, 1.0, 1.0);  /// No attenuation
+    // A smooth interface: reflection or refraction, picked in proportion to
+    // the Fresnel reflectance, so both are specular with unit weight.
+    srec.bsdf = color(1.0, 1.0, 1.0);  /// No attenuation
+    srec.pdf = 0;
 
     double ri = rec.front_face
                     ? (1.0 / refraction_index)
@@ -98,7 +291,7 @@ class dielectric : public material
     bool cannot_refract = ri * sin_theta > 1.0;
     vec3 direction;
 
-    if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+    if (cannot_refract || reflectance(cos_theta, ri) > u.x)
     {
       direction = reflect(unit_direction, rec.normal);
     }
@@ -107,7 +300,7 @@ class dielectric : public material
       direction = refract(unit_direction, rec.normal, ri);
     }
 
-    scattered = ray(rec.p, direction, r_in.time());
+    srec.scattered = rec.spawn_ray(direction, r_in.time());
 
     return true;
   }
@@ -122,10 +315,13 @@ class diffuse_light : public material
   diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
   diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
 
-  color emitted(double u, double v, const point3& p) const override
+  color emitted(double u, double v, const point3& p,
+                double footprint) const override
   {
-    return tex->value(u, v, p);
+    return tex->value(u, v, p, footprint);
   }
+
+  bool is_emissive() const override { return true; }
 };
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class material;
+
+class material_table
+{
+  // Flat, process-wide table of scene materials. Primitives register their
+  // material once, when they are built, and keep only its 32-bit ID; hit
+  // records carry the ID and shading looks it up with a plain array index, so
+  // no reference count is touched while rendering.
+  //
+  // The table owns a reference to every registered material for the rest of
+  // the process. Registration is thread safe, but lookups are not synchronised
+  // with it: scenes must be fully built before rendering starts.
+
+ private:
+  struct storage
+  {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<material>> owned;
+    std::vector<const material*> entries;
+    std::unordered_map<const material*, uint32_t> ids;
+  };
+
+  static storage& instance()
+  {
+    static storage s;
+    return s;
+  }
+
+ public:
+  // Returns the ID of the material, registering it on first use. Primitives
+  // sharing a material share its ID.
+  static uint32_t add(const std::shared_ptr<material>& mat)
+  {
+    auto& s = instance();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto found = s.ids.find(mat.get());
+    if (found != s.ids.end()) return found->second;
+
+    auto id = uint32_t(s.entries.size());
+    s.owned.push_back(mat);
+    s.entries.push_back(mat.get());
+    s.ids.emplace(mat.get(), id);
+    return id;
+  }
+
+  static const material* get(uint32_t id) { return instance().entries[id]; }
+
+  static size_t size() { return instance().entries.size(); }
+};
+
+#endif
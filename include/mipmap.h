@@ -0,0 +1,340 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOYRENDERER_HAS_MMAP 1
+#endif
+
+#include "color.h"
+#include "common.h"
+#include "rtw_stb_image.h"
+
+// How an image texture turns a lookup into a color.
+enum class texture_filter
+{
+  nearest,    // The base level texel under the point, unfiltered
+  bilinear,   // Four texels of the level closest to the footprint
+  trilinear,  // Bilinear on the two levels around the footprint, blended
+};
+
+class mipmap
+{
+  // An image as a pyramid of levels, each a box-filtered half of the one
+  // before, down to a single texel. A lookup reads the level whose texels
+  // are about as wide as its footprint, so a minified texture averages what
+  // falls in a pixel rather than picking one texel of it, which would alias.
+  //
+  // Texels are 8-bit RGBA, stored in 4x4 tiles: a tile is exactly one
+  // 64-byte cache line, so the four texels of a bilinear lookup, and those
+  // of nearby lookups, come from one or two lines rather than one per row.
+  // The bytes hold color with gamma 2.2, the curve the loader decoded the
+  // file with, so the base level keeps the file's own values and dark
+  // texels keep their precision through the averaging; filtering itself is
+  // done on linear values.
+  //
+  // The tiles of all levels are one block, either built in memory or a
+  // read-only mapping of a file that write() saved, which the system pages
+  // in as lookups touch it and can drop again under memory pressure.
+
+ public:
+  mipmap() {}
+
+  explicit mipmap(const rtw_image& image)
+  {
+    if (image.width() <= 0 || image.height() <= 0) return;
+
+    auto sizes = level_sizes(image.width(), image.height());
+    owned.resize(tile_count(sizes));
+    place_levels(sizes, owned.data());
+
+    for (int j = 0; j < image.height(); j++)
+      for (int i = 0; i < image.width(); i++)
+      {
+        auto pixel = image.linear_pixel_data(i, j);
+        set(0, i, j, color(pixel[0], pixel[1], pixel[2]));
+      }
+
+    // Each texel averages the 2x2 texels above it, fewer at an odd edge.
+    for (size_t k = 1; k < levels.size(); k++)
+    {
+      const auto& fine = levels[k - 1];
+      for (int j = 0; j < levels[k].height; j++)
+        for (int i = 0; i < levels[k].width; i++)
+        {
+          color sum(0, 0, 0);
+          int count = 0;
+          for (int y = 2 * j; y < std::min(2 * j + 2, fine.height); y++)
+            for (int x = 2 * i; x < std::min(2 * i + 2, fine.width); x++)
+            {
+              sum += decode(fine.texel(x, y));
+              count++;
+            }
+          set(k, i, j, sum / count);
+        }
+    }
+  }
+
+  // Levels point into the tiles, so a pyramid stays where it was built.
+  mipmap(const mipmap&) = delete;
+  mipmap& operator=(const mipmap&) = delete;
+
+  ~mipmap()
+  {
+#ifdef TOYRENDERER_HAS_MMAP
+    if (mapping) munmap(mapping, mapping_size);
+#endif
+  }
+
+  bool empty() const { return levels.empty(); }
+  int level_count() const { return int(levels.size()); }
+
+  // Bytes of texel data over all levels.
+  size_t size() const
+  {
+    size_t tiles = 0;
+    for (const auto& l : levels) tiles += l.tile_count();
+    return tiles * sizeof(tile);
+  }
+
+  // Whether the texels are a mapped file rather than memory of the process.
+  bool mapped() const { return mapping != nullptr; }
+
+  // The color at (u, v), with v pointing up the image, filtered over a
+  // footprint `footprint` uv units wide. Coordinates outside [0, 1] clamp
+  // to the edge.
+  color lookup(double u, double v, double footprint,
+               texture_filter filter) const
+  {
+    u = interval(0, 1).clamp(u);
+    v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
+
+    const auto& base = levels[0];
+    if (filter == texture_filter::nearest)
+    {
+      auto i = std::min(int(u * base.width), base.width - 1);
+      auto j = std::min(int(v * base.height), base.height - 1);
+      return decode(base.texel(i, j));
+    }
+
+    // Level whose texels span the footprint, along the geometric mean of the
+    // base's sides.
+    auto texels = footprint * std::sqrt(double(base.width) * base.height);
+    auto lod = texels > 1 ? std::log2(texels) : 0.0;
+    lod = std::min(lod, double(levels.size() - 1));
+
+    if (filter == texture_filter::bilinear)
+      return bilinear(levels[int(lod + 0.5)], u, v);
+
+    int fine = int(lod);
+    auto blend = lod - fine;
+    auto c = bilinear(levels[fine], u, v);
+    if (blend == 0) return c;
+    return (1 - blend) * c + blend * bilinear(levels[fine + 1], u, v);
+  }
+
+  // Saves the pyramid to `path` for map() to read back, tagged with `stamp`
+  // to tell which version of the source image it was built from. The file
+  // is in the byte order of this machine, for its own later runs.
+  bool write(const std::string& path, uint64_t stamp) const
+  {
+    if (empty()) return false;
+
+    file_header header{};
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.stamp = stamp;
+    header.width = uint32_t(levels[0].width);
+    header.height = uint32_t(levels[0].height);
+
+    // Written under another name and renamed into place, so a concurrent
+    // reader never maps half a file.
+    auto partial = path + ".partial";
+    {
+      std::ofstream out(partial, std::ios::binary);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (const auto& l : levels)
+        out.write(reinterpret_cast<const char*>(l.tiles),
+                  std::streamsize(l.tile_count() * sizeof(tile)));
+      if (!out)
+      {
+        std::remove(partial.c_str());
+        return false;
+      }
+    }
+    return std::rename(partial.c_str(), path.c_str()) == 0;
+  }
+
+  // Maps the file write() saved at `path` with the same stamp. Returns null
+  // if there is none, it is stale or truncated, or files cannot be mapped.
+  static std::unique_ptr<mipmap> map(const std::string& path, uint64_t stamp)
+  {
+#ifdef TOYRENDERER_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(file_header))
+      data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping outlives the descriptor
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<mipmap> result(new mipmap());
+    result->mapping = data;
+    result->mapping_size = size_t(info.st_size);
+
+    const auto& header = *static_cast<const file_header*>(data);
+    if (std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0 ||
+        header.stamp != stamp || header.width == 0 || header.height == 0)
+      return nullptr;
+
+    auto sizes = level_sizes(int(header.width), int(header.height));
+    if (result->mapping_size !=
+        sizeof(file_header) + tile_count(sizes) * sizeof(tile))
+      return nullptr;
+
+    // The tiles are only read through a const mipmap.
+    auto tiles = reinterpret_cast<tile*>(static_cast<char*>(data) +
+                                         sizeof(file_header));
+    result->place_levels(sizes, tiles);
+    return result;
+#else
+    (void)path;
+    (void)stamp;
+    return nullptr;
+#endif
+  }
+
+ private:
+  struct alignas(64) tile
+  {
+    uint8_t texels[16][4];  // Row-major RGBA, the fourth byte unused
+  };
+
+  // Padded to a tile, so the tiles after it in a file stay aligned.
+  struct alignas(64) file_header
+  {
+    char magic[8];
+    uint64_t stamp;
+    uint32_t width, height;  // Of the base level; the rest follow from it
+  };
+
+  static constexpr char file_magic[8] = {'T', 'R', 'M', 'I', 'P', '0', '1'};
+
+  struct level
+  {
+    int width, height;
+    int tiles_x;
+    tile* tiles;  // Row-major, tiles_x to a row
+
+    size_t tile_count() const { return size_t(tiles_x) * ((height + 3) / 4); }
+
+    const uint8_t* texel(int i, int j) const
+    {
+      return tiles[size_t(j >> 2) * tiles_x + (i >> 2)]
+          .texels[(j & 3) * 4 + (i & 3)];
+    }
+  };
+
+  std::vector<level> levels;
+  std::vector<tile> owned;  // The tiles when built in memory,
+  void* mapping = nullptr;  // or the mapped file that holds them
+  size_t mapping_size = 0;
+
+  static std::vector<std::pair<int, int>> level_sizes(int width, int height)
+  {
+    std::vector<std::pair<int, int>> sizes{{width, height}};
+    while (width > 1 || height > 1)
+    {
+      width = std::max(1, (width + 1) / 2);
+      height = std::max(1, (height + 1) / 2);
+      sizes.emplace_back(width, height);
+    }
+    return sizes;
+  }
+
+  static size_t tile_count(const std::vector<std::pair<int, int>>& sizes)
+  {
+    size_t count = 0;
+    for (const auto& s : sizes)
+      count += size_t((s.first + 3) / 4) * ((s.second + 3) / 4);
+    return count;
+  }
+
+  // Lays the levels out back to back from `tiles` on.
+  void place_levels(const std::vector<std::pair<int, int>>& sizes, tile* tiles)
+  {
+    for (const auto& s : sizes)
+    {
+      levels.push_back(level{s.first, s.second, (s.first + 3) / 4, tiles});
+      tiles += levels.back().tile_count();
+    }
+  }
+
+  void set(size_t k, int i, int j, const color& c)
+  {
+    const auto& l = levels[k];
+    auto t = l.tiles[size_t(j >> 2) * l.tiles_x + (i >> 2)]
+                 .texels[(j & 3) * 4 + (i & 3)];
+    for (int n = 0; n < 3; n++) t[n] = encode(c[n]);
+  }
+
+  static uint8_t encode(double linear)
+  {
+    linear = interval(0, 1).clamp(linear);
+    return uint8_t(255 * std::pow(linear, 1 / 2.2) + 0.5);
+  }
+
+  static const float* decoding_table()
+  {
+    static const auto table = [] {
+      std::array<float, 256> t;
+      for (int k = 0; k < 256; k++) t[k] = float(std::pow(k / 255.0, 2.2));
+      return t;
+    }();
+    return table.data();
+  }
+
+  static color decode(const uint8_t* t)
+  {
+    auto table = decoding_table();
+    return color(table[t[0]], table[t[1]], table[t[2]]);
+  }
+
+  static color bilinear(const level& l, double u, double v)
+  {
+    // Texel centers sit at half-integer coordinates; the texels beyond the
+    // edges repeat the edge.
+    auto x = u * l.width - 0.5, y = v * l.height - 0.5;
+    auto x0 = std::floor(x), y0 = std::floor(y);
+    auto fx = x - x0, fy = y - y0;
+
+    int i0 = std::clamp(int(x0), 0, l.width - 1);
+    int i1 = std::clamp(int(x0) + 1, 0, l.width - 1);
+    int j0 = std::clamp(int(y0), 0, l.height - 1);
+    int j1 = std::clamp(int(y0) + 1, 0, l.height - 1);
+
+    auto top =
+        (1 - fx) * decode(l.texel(i0, j0)) + fx * decode(l.texel(i1, j0));
+    auto bottom =
+        (1 - fx) * decode(l.texel(i0, j1)) + fx * decode(l.texel(i1, j1));
+    return (1 - fy) * top + fy * bottom;
+  }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef PDF_H
+#define PDF_H
+
+#include "common.h"
+#include "light_list.h"
+#include "onb.h"
+#include "warp.h"
+
+class pdf
+{
+  // A distribution of directions that can be both sampled and evaluated, so
+  // samples can be weighted by their density. Instances are cheap values
+  // built on the stack for a single scattering event.
+
+ public:
+  virtual ~pdf() = default;
+
+  // Density per unit solid angle of picking `direction`, which need not be
+  // normalized.
+  virtual double value(const vec3& direction) const = 0;
+
+  // Maps a point of the unit square to a direction.
+  virtual vec3 generate(const sample2& u) const = 0;
+};
+
+class cosine_pdf : public pdf
+{
+  // Directions over the hemisphere around a normal, with density
+  // proportional to the cosine to it: the ideal distribution for a
+  // Lambertian surface.
+
+ public:
+  cosine_pdf(const vec3& normal) : frame(normal) {}
+
+  double value(const vec3& direction) const override
+  {
+    auto cos_theta = dot(unit_vector(direction), frame.w());
+    return cos_theta > 0 ? cos_theta / pi : 0;
+  }
+
+  vec3 generate(const sample2& u) const override
+  {
+    return frame.transform(sample_cosine_hemisphere(u));
+  }
+
+ private:
+  onb frame;
+};
+
+class ggx_pdf : public pdf
+{
+  // Mirror directions about microfacet normals drawn from the GGX (Trowbridge
+  // -Reitz) distribution with roughness alpha, as seen from direction wo. The
+  // helpers give the terms of the matching microfacet BRDF.
+
+ public:
+  ggx_pdf(const vec3& normal, const vec3& wo, double alpha)
+      : frame(normal), wo(wo), alpha(std::fmax(alpha, 1e-4))
+  {
+  }
+
+  // Distribution of microfacet normals, D(h), given the cosine between h and
+  // the surface normal.
+  static double distribution(double cos_h, double alpha)
+  {
+    if (cos_h <= 0) return 0;
+    auto a2 = alpha * alpha;
+    auto d = cos_h * cos_h * (a2 - 1) + 1;
+    return a2 / (pi * d * d);
+  }
+
+  // Smith masking of one direction at the given cosine to the normal.
+  static double masking(double cos_v, double alpha)
+  {
+    if (cos_v <= 0) return 0;
+    auto a2 = alpha * alpha;
+    return 2 * cos_v / (cos_v + std::sqrt(a2 + (1 - a2) * cos_v * cos_v));
+  }
+
+  double value(const vec3& direction) const override
+  {
+    auto wi = unit_vector(direction);
+    auto h = wo + wi;
+    if (h.near_zero()) return 0;
+    h = unit_vector(h);
+
+    auto cos_h = dot(h, frame.w());
+    auto wo_dot_h = std::fabs(dot(wo, h));
+    if (wo_dot_h <= 0) return 0;
+    return distribution(cos_h, alpha) * cos_h / (4 * wo_dot_h);
+  }
+
+  vec3 generate(const sample2& u) const override
+  {
+    // Invert the CDF of D(h) cos(theta_h) for theta_h; phi is uniform.
+    auto r1 = u.x, r2 = u.y;
+    auto tan2 = alpha * alpha * r1 / (1 - r1);
+    auto cos_theta = 1 / std::sqrt(1 + tan2);
+    auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+    auto phi = 2 * pi * r2;
+
+    auto h = frame.transform(vec3(std::cos(phi) * sin_theta,
+                                  std::sin(phi) * sin_theta, cos_theta));
+    return reflect(-wo, h);
+  }
+
+ private:
+  onb frame;
+  vec3 wo;  // Unit direction towards the viewer
+  double alpha;
+};
+
+class mixture_pdf : public pdf
+{
+  // Picks from one of two distributions, the first with probability
+  // `weight`. The parts are referenced, not copied, and must outlive it.
+
+ public:
+  mixture_pdf(const pdf& p0, const pdf& p1, double weight = 0.5)
+      : p0(p0), p1(p1), weight(weight)
+  {
+  }
+
+  double value(const vec3& direction) const override
+  {
+    return weight * p0.value(direction) + (1 - weight) * p1.value(direction);
+  }
+
+  vec3 generate(const sample2& u) const override
+  {
+    // u.x makes the choice and is then stretched back over [0, 1[, so the
+    // chosen part still gets a well distributed point.
+    if (u.x < weight) return p0.generate({u.x / weight, u.y});
+    return p1.generate(
+        {std::fmin((u.x - weight) / (1 - weight), 0x1.fffffffffffffp-1), u.y});
+  }
+
+ private:
+  const pdf& p0;
+  const pdf& p1;
+  double weight;
+};
+
+class hittable_pdf : public pdf
+{
+  // Directions from a point towards the surfaces of a scene's lights, as
+  // sampled by the light list, which must not be empty. Mixed with a
+  // material's distribution, it steers bounces towards the lights.
+
+ public:
+  hittable_pdf(const light_list& lights, const point3& origin, double time)
+      : lights(lights), origin(origin), time(time)
+  {
+  }
+
+  double value(const vec3& direction) const override
+  {
+    return lights.pdf_value(origin, direction, time);
+  }
+
+  vec3 generate(const sample2& u) const override
+  {
+    light_sample s;
+    lights.sample(origin, time, u, s);
+    return s.point.p - origin;
+  }
+
+ private:
+  const light_list& lights;
+  point3 origin;
+  double time;
+};
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
+#include <algorithm>
+#include <vector>
+
+#include "aabb.h"
 #include "common.h"
+#include "thread_pool.h"
+
 class perlin
 {
  private:
@@ -25,23 +31,24 @@ class perlin
 
   double noise(const point3& p) const
   {
-    auto u = p.x() - std::floor(p.x());
-    auto v = p.y() - std::floor(p.y());
-    auto w = p.z() - std::floor(p.z());
-
-    int i = std::floor(p.x());
-    int j = std::floor(p.y());
-    int k = std::floor(p.z());
-    vec3 c[2][2][2];
-
-    for (int di = 0; di < 2; di++)
-      for (int dj = 0; dj < 2; dj++)
-        for (int dk = 0; dk < 2; dk++)
-          c[di][dj][dk] =
-              randvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^
-                      perm_z[(k + dk) & 255]];
-
-    return perlin_interp(c, u, v, w);
+    // The floor is taken by truncating and stepping down below zero, which
+    // compiles to a few instructions where std::floor may be a library call.
+    int i = int(p.x()), j = int(p.y()), k = int(p.z());
+    i -= p.x() < i;
+    j -= p.y() < j;
+    k -= p.z() < k;
+
+    auto u = p.x() - i;
+    auto v = p.y() - j;
+    auto w = p.z() - k;
+
+    // Each corner's gradient is picked by one permutation entry per axis,
+    // so six lookups serve all eight corners.
+    int hash_x[2] = {perm_x[i & 255], perm_x[(i + 1) & 255]};
+    int hash_y[2] = {perm_y[j & 255], perm_y[(j + 1) & 255]};
+    int hash_z[2] = {perm_z[k & 255], perm_z[(k + 1) & 255]};
+
+    return perlin_interp(hash_x, hash_y, hash_z, u, v, w);
   }
 
   double turb(const point3& p, int depth) const
@@ -60,6 +67,12 @@ class perlin
     return std::fabs(accum);
   }
 
+  // turb() of `count` points, into `out`.
+  void turb(const point3* points, double* out, size_t count, int depth) const
+  {
+    for (size_t i = 0; i < count; i++) out[i] = turb(points[i], depth);
+  }
+
  private:
   static void perlin_generate_perm(int* p)
   {
@@ -81,25 +94,110 @@ class perlin
     }
   }
 
-  static double perlin_interp(const vec3 c[2][2][2], double u, double v,
-                              double w)
+  double perlin_interp(const int hash_x[2], const int hash_y[2],
+                       const int hash_z[2], double u, double v,
+                       double w) const
   {
+    // Hermite weights of the near (0) and far (1) corner along each axis.
     auto uu = u * u * (3 - 2 * u);
     auto vv = v * v * (3 - 2 * v);
     auto ww = w * w * (3 - 2 * w);
+    double weight_u[2] = {1 - uu, uu};
+    double weight_v[2] = {1 - vv, vv};
+    double weight_w[2] = {1 - ww, ww};
 
     auto accum = 0.0;
     for (int i = 0; i < 2; i++)
       for (int j = 0; j < 2; j++)
         for (int k = 0; k < 2; k++)
         {
-          vec3 weight_v = vec3(u - i, v - j, w - k);
-          accum += (i * uu + (1 - i) * (1 - uu)) *
-                   (j * vv + (1 - j) * (1 - vv)) *
-                   (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
+          const auto& c = randvec[hash_x[i] ^ hash_y[j] ^ hash_z[k]];
+          accum += weight_u[i] * weight_v[j] * weight_w[k] *
+                   dot(c, vec3(u - i, v - j, w - k));
         }
     return accum;
   }
 };
 
+class noise_volume
+{
+  // turb() of a perlin baked into a grid over a box, for regions that are
+  // looked up often: a trilinear lookup reads eight samples where turb()
+  // evaluates every octave. Detail finer than the grid spacing is smoothed
+  // away, so the resolution should resolve the finest octave that shows.
+
+ public:
+  // `resolution` is in samples per unit of length. With a pool, slices of
+  // the grid are baked in parallel.
+  noise_volume(const perlin& noise, const aabb& bounds, double resolution,
+               int depth, thread_pool* pool = nullptr)
+      : bounds(bounds), resolution(resolution)
+  {
+    for (int a = 0; a < 3; a++)
+      size[a] = std::max(
+          2, int(std::ceil(bounds.axis_interval(a).size() * resolution)) + 1);
+    samples.resize(size_t(size[0]) * size[1] * size[2]);
+
+    // A row along x at a time, through the batch turb().
+    auto bake_slice = [&](int k, int) {
+      std::vector<point3> row(size[0]);
+      std::vector<double> values(size[0]);
+      for (int j = 0; j < size[1]; j++)
+      {
+        for (int i = 0; i < size[0]; i++)
+          row[i] = point3(bounds.x.min + i / resolution,
+                          bounds.y.min + j / resolution,
+                          bounds.z.min + k / resolution);
+        noise.turb(row.data(), values.data(), row.size(), depth);
+        std::copy(values.begin(), values.end(),
+                  samples.begin() + (size_t(k) * size[1] + j) * size[0]);
+      }
+    };
+
+    if (pool)
+      pool->parallel_for(size[2], bake_slice);
+    else
+      for (int k = 0; k < size[2]; k++) bake_slice(k, 0);
+  }
+
+  bool contains(const point3& p) const
+  {
+    return bounds.x.contains(p.x()) && bounds.y.contains(p.y()) &&
+           bounds.z.contains(p.z());
+  }
+
+  // The baked turbulence at p, which must lie in the box.
+  double lookup(const point3& p) const
+  {
+    int cell[3];
+    double t[3];
+    for (int a = 0; a < 3; a++)
+    {
+      auto x = (p[a] - bounds.axis_interval(a).min) * resolution;
+      cell[a] = std::clamp(int(x), 0, size[a] - 2);
+      t[a] = std::clamp(x - cell[a], 0.0, 1.0);
+    }
+
+    auto at = [&](int di, int dj, int dk) {
+      return double(samples[(size_t(cell[2] + dk) * size[1] + cell[1] + dj) *
+                                size[0] +
+                            cell[0] + di]);
+    };
+    auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+    auto x00 = lerp(at(0, 0, 0), at(1, 0, 0), t[0]);
+    auto x10 = lerp(at(0, 1, 0), at(1, 1, 0), t[0]);
+    auto x01 = lerp(at(0, 0, 1), at(1, 0, 1), t[0]);
+    auto x11 = lerp(at(0, 1, 1), at(1, 1, 1), t[0]);
+    return lerp(lerp(x00, x10, t[1]), lerp(x01, x11, t[1]), t[2]);
+  }
+
+  size_t size_in_bytes() const { return samples.size() * sizeof(float); }
+
+ private:
+  aabb bounds;
+  double resolution;
+  int size[3];                // Samples along each axis
+  std::vector<float> samples;  // x fastest, then y, then z
+};
+
 #endif
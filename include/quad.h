@@ -2,6 +2,8 @@
 #define QUAD_H
 
 #include "hittable.h"
+#include "material.h"
+#include "material_table.h"
 #include "vec3.h"
 
 class quad : public hittable
@@ -10,20 +12,23 @@ class quad : public hittable
   point3 Q;
   vec3 u, v;
   vec3 w;
-  shared_ptr<material> mat;
+  uint32_t mat_id;
+  uint32_t prim_id = new_primitive_id();
   aabb bbox;
   vec3 normal;
-  double D;
+  real D;
+  real uv_density;  // The unit uv square spread evenly over the area
 
  public:
   quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> mat)
-      : Q(Q), u(u), v(v), mat(mat)
+      : Q(Q), u(u), v(v), mat_id(material_table::add(mat))
   {
     auto n = cross(u, v);
     normal = unit_vector(n);
     D = dot(normal, Q);
     set_bounding_box();
     w = n / dot(n, n);
+    uv_density = 1 / std::sqrt(n.length());
   }
 
   virtual void set_bounding_box()
@@ -36,7 +41,25 @@ class quad : public hittable
 
   aabb bounding_box() const override { return bbox; }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
+  {
+    if (material_table::get(mat_id)->is_emissive()) emitters.push_back(this);
+  }
+
+  double area() const override { return cross(u, v).length(); }
+
+  void sample_surface(real time, const sample2& sample,
+                      hit_record& rec) const override
+  {
+    rec.u = sample.x;
+    rec.v = sample.y;
+    rec.p = Q + rec.u * u + rec.v * v;
+    rec.normal = normal;
+    rec.mat_id = mat_id;
+    rec.prim_id = prim_id;
+  }
+
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
   {
     auto denom = dot(normal, r.direction());
 
@@ -54,28 +77,92 @@ class quad : public hittable
     auto alpha = dot(w, cross(planar_hitpt_vector, v));
     auto beta = dot(w, cross(u, planar_hitpt_vector));
 
-    if (!is_interior(alpha, beta, rec)) return false;
+    if (!is_interior(alpha, beta)) return false;
 
-    // Ray hits the 2D shape; set the rest of the hit record and return true
-    rec.t = t;
-    rec.p = intersection;
-    rec.mat = mat;
-    rec.set_face_normal(r, normal);
+    // Ray hits the 2D shape; the planar coordinates are its UV coordinates
+    hit.t = t;
+    hit.object = this;
+    hit.prim_id = prim_id;
+    hit.u = alpha;
+    hit.v = beta;
 
     return true;
   }
 
-  bool is_interior(double a, double b, hit_record& rec) const
+  void intersect_packet(ray_packet& packet, uint32_t mask) const override
   {
-    interval unit_interval = interval(0, 1);
-    // Given the hit point in the plane coordinates, return false if it is
-    // outside the primitive, otherwise set the hit record UV coordinates and
-    // return true
-    if (!unit_interval.contains(a) || !unit_interval.contains(b)) return false;
+    // The single-ray test on every lane at once, without branches.
+    const int n = ray_packet::size;
+    alignas(64) real ts[n], alphas[n], betas[n];
+    alignas(64) real hits[n];  // 1 for lanes that hit, else 0
 
-    rec.u = a;
-    rec.v = b;
-    return true;
+    for (int k = 0; k < n; k++)
+    {
+      auto ox = packet.ox[k], oy = packet.oy[k], oz = packet.oz[k];
+      auto dx = packet.dx[k], dy = packet.dy[k], dz = packet.dz[k];
+
+      auto denom = normal.x() * dx + normal.y() * dy + normal.z() * dz;
+      auto t = (D - (normal.x() * ox + normal.y() * oy + normal.z() * oz)) /
+               denom;
+
+      auto px = (ox + t * dx) - Q.x();
+      auto py = (oy + t * dy) - Q.y();
+      auto pz = (oz + t * dz) - Q.z();
+      auto alpha = w.x() * (py * v.z() - pz * v.y()) +
+                   w.y() * (pz * v.x() - px * v.z()) +
+                   w.z() * (px * v.y() - py * v.x());
+      auto beta = w.x() * (u.y() * pz - u.z() * py) +
+                  w.y() * (u.z() * px - u.x() * pz) +
+                  w.z() * (u.x() * py - u.y() * px);
+
+      ts[k] = t;
+      alphas[k] = alpha;
+      betas[k] = beta;
+      hits[k] = (std::fabs(denom) >= 1.e-8) & (packet.tmin[k] <= t) &
+                (t <= packet.tmax[k]) & (0 <= alpha) & (alpha <= 1) &
+                        (0 <= beta) & (beta <= 1)
+                    ? 1.0
+                    : 0.0;
+    }
+
+    for_each_lane(mask, [&](int k) {
+      if (hits[k] != 0)
+        packet.record(k, {ts[k], this, prim_id, alphas[k], betas[k]});
+    });
+  }
+
+  bool occluded(const ray& r, interval ray_t) const override
+  {
+    auto denom = dot(normal, r.direction());
+    if (std::fabs(denom) < 1.e-8) return false;
+
+    auto t = (D - dot(normal, r.origin())) / denom;
+    if (!ray_t.contains(t)) return false;
+
+    vec3 planar_hitpt_vector = r.at(t) - Q;
+    return is_interior(dot(w, cross(planar_hitpt_vector, v)),
+                       dot(w, cross(u, planar_hitpt_vector)));
+  }
+
+  void finalize(const ray& r, const ray_hit& hit,
+                hit_record& rec) const override
+  {
+    rec.t = hit.t;
+    rec.p = r.at(rec.t);
+    rec.u = hit.u;
+    rec.v = hit.v;
+    rec.mat_id = mat_id;
+    rec.prim_id = prim_id;
+    rec.uv_density = uv_density;
+    rec.set_face_normal(r, normal);
+  }
+
+  bool is_interior(real a, real b) const
+  {
+    // Given the hit point in the plane coordinates, return false if it is
+    // outside the primitive
+    interval unit_interval = interval(0, 1);
+    return unit_interval.contains(a) && unit_interval.contains(b);
   }
 };
 
@@ -8,11 +8,11 @@ class ray
  private:
   point3 orig;
   vec3 dir;
-  double tm;
+  real tm;
 
  public:
   ray() {}
-  ray(const point3& origin, const vec3& direction, double time)
+  ray(const point3& origin, const vec3& direction, real time)
       : orig(origin), dir(direction), tm(time)
   {
   }
@@ -24,9 +24,9 @@ class ray
 
   const point3& origin() const { return orig; }
   const vec3& direction() const { return dir; }
-  double time() const { return tm; }
+  real time() const { return tm; }
 
-  point3 at(double t) const { return orig + t * dir; }
+  point3 at(real t) const { return orig + t * dir; }
 };
 
 #endif
\ No newline at end of file
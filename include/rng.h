@@ -0,0 +1,98 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+class rng
+{
+  // PCG32 (O'Neill, "PCG: A Family of Simple Fast Space-Efficient
+  // Statistically Good Algorithms for Random Number Generation"): a 64-bit LCG
+  // whose output is scrambled by a xorshift and a state-dependent rotation.
+  // The whole generator is 16 bytes and one step is a multiply-add, so it is
+  // cheap enough to reseed for every camera sample.
+
+ private:
+  static constexpr uint64_t multiplier = 6364136223846793005ULL;
+
+  uint64_t state = 0x853c49e6748fea9bULL;
+  uint64_t inc = 0xda3e39cb94b95bdbULL;  // Stream selector, always odd
+
+  static constexpr uint64_t mix(uint64_t x)
+  {
+    // SplitMix64 finaliser. Turns structured inputs such as consecutive pixel
+    // indices into well-spread seeds.
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+ public:
+  constexpr rng() {}
+  constexpr rng(uint64_t seed, uint64_t stream = 0) { this->seed(seed, stream); }
+
+  constexpr void seed(uint64_t seed, uint64_t stream = 0)
+  {
+    state = 0;
+    inc = (stream << 1) | 1;
+    next_uint();
+    state += seed;
+    next_uint();
+  }
+
+  constexpr void seed_for_sample(uint64_t pixel_index, uint64_t sample_index)
+  {
+    // Derives the generator state from where and which sample is being taken,
+    // never from what was drawn before. A pixel sample therefore sees the same
+    // numbers whatever thread renders it and in whatever order.
+    seed(mix(pixel_index ^ mix(sample_index)), pixel_index);
+  }
+
+  constexpr uint32_t next_uint()
+  {
+    uint64_t old_state = state;
+    state = old_state * multiplier + inc;
+
+    auto xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+    auto rotation = uint32_t(old_state >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+  }
+
+  constexpr void advance(uint64_t delta)
+  {
+    // Jumps delta steps ahead in O(log delta) by composing the LCG step with
+    // itself (Brown, "Random Number Generation with Arbitrary Strides").
+    uint64_t acc_mult = 1, acc_plus = 0;
+    uint64_t cur_mult = multiplier, cur_plus = inc;
+    for (; delta > 0; delta >>= 1)
+    {
+      if (delta & 1)
+      {
+        acc_mult *= cur_mult;
+        acc_plus = acc_plus * cur_mult + cur_plus;
+      }
+      cur_plus = (cur_mult + 1) * cur_plus;
+      cur_mult *= cur_mult;
+    }
+    state = acc_mult * state + acc_plus;
+  }
+
+  double next_double()
+  {
+    // Returns a real in [0, 1[ carrying the full 53 bits of double precision,
+    // built from two 32-bit outputs.
+    uint64_t hi = next_uint() >> 5;  // 27 bits
+    uint64_t lo = next_uint() >> 6;  // 26 bits
+    return double((hi << 26) | lo) * (1.0 / 9007199254740992.0);
+  }
+};
+
+inline rng& thread_rng()
+{
+  // The generator used by random_double() and everything built on it. Each
+  // thread owns one, so render workers share no random state.
+  thread_local rng generator;
+  return generator;
+}
+
+#endif
@@ -10,7 +10,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "../external/stb_image/stb_image.h"
 
@@ -21,32 +24,42 @@ class rtw_image
 
   rtw_image(const char* image_filename)
   {
-    // Loads image data from the specified file. If the RTW_IMAGES environment
-    // variable is defined, looks only in that directory for the image file. If
-    // the image was not found, searches for the specified image file first from
-    // the current directory, then in the images/ subdirectory, then the
-    // _parent's_ images/ subdirectory, and then _that_ parent, on so on, for
-    // six levels up. If the image was not loaded successfully, width() and
-    // height() will return 0.
+    // Loads image data from the file find() locates. If the image was not
+    // loaded successfully, width() and height() will return 0.
 
-    auto filename = std::string(image_filename);
-    auto imagedir = getenv("RTW_IMAGES");
-
-    // Hunt for the image file in some likely locations.
-    if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-    if (load(filename)) return;
-    if (load("resources/" + filename)) return;
-    if (load("../resources/" + filename)) return;
-    if (load("../../resources/" + filename)) return;
-    if (load("../../../resources/" + filename)) return;
-    if (load("../../../../resources/" + filename)) return;
-    if (load("../../../../../resources/" + filename)) return;
-    if (load("../../../../../../resources/" + filename)) return;
+    auto filename = find(image_filename);
+    if (!filename.empty() && load(filename)) return;
 
     std::cerr << "ERROR: Could not load image file '" << image_filename
               << "'.\n";
   }
 
+  static std::string find(const char* image_filename)
+  {
+    // Returns the path of the specified image file, or an empty string if
+    // there is none. If the RTW_IMAGES environment variable is defined, looks
+    // only in that directory for the image file. If the image was not found,
+    // searches for the specified image file first from the current
+    // directory, then in the resources/ subdirectory, then the _parent's_
+    // resources/ subdirectory, and then _that_ parent, on so on, for six
+    // levels up. Only checks that the files exist, without reading them.
+
+    auto filename = std::string(image_filename);
+    auto imagedir = getenv("RTW_IMAGES");
+
+    std::vector<std::string> candidates;
+    if (imagedir) candidates.push_back(std::string(imagedir) + "/" + filename);
+    candidates.push_back(filename);
+    std::string prefix = "resources/";
+    for (int up = 0; up <= 6; up++, prefix = "../" + prefix)
+      candidates.push_back(prefix + filename);
+
+    std::error_code error;
+    for (const auto& candidate : candidates)
+      if (std::filesystem::is_regular_file(candidate, error)) return candidate;
+    return "";
+  }
+
   ~rtw_image()
   {
     delete[] bdata;
@@ -89,6 +102,19 @@ class rtw_image
     return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
   }
 
+  const float* linear_pixel_data(int x, int y) const
+  {
+    // Return the address of the three linear RGB floats of the pixel at x,y.
+    // If there is no image data, returns magenta.
+    static float magenta[] = {1, 0, 1};
+    if (fdata == nullptr) return magenta;
+
+    x = clamp(x, 0, image_width);
+    y = clamp(y, 0, image_height);
+
+    return fdata + (size_t(y) * image_width + x) * bytes_per_pixel;
+  }
+
  private:
   const int bytes_per_pixel = 3;
   float* fdata = nullptr;          // Linear floating point pixel data
@@ -0,0 +1,492 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "warp.h"
+
+class sampler
+{
+  // Source of the numbers driving each camera sample. The integrator draws
+  // them in a fixed order of dimensions (the pixel position, lens, time, then
+  // a fixed set per bounce), so dimension k of every sample of a pixel serves
+  // the same purpose, and patterns that spread samples evenly within a
+  // dimension pay off.
+  //
+  // A sampler holds the state of one sample at a time; each render worker
+  // uses its own clone.
+
+ public:
+  virtual ~sampler() = default;
+
+  // A fresh sampler of the same kind for pixels taking `samples_per_pixel`
+  // samples. More samples may be asked for (adaptive sampling), at some loss
+  // of stratification.
+  virtual std::unique_ptr<sampler> clone(int samples_per_pixel) const = 0;
+
+  // Starts the given sample of pixel (x, y), from dimension 0.
+  virtual void start_sample(int x, int y, int sample_index) = 0;
+
+  // Continues the current sample from the given dimension, so integrators
+  // that advance many paths in step can resume each one where it left off.
+  virtual void set_dimension(int dimension) = 0;
+
+  virtual double get_1d() = 0;
+  virtual sample2 get_2d() = 0;
+};
+
+namespace sampling
+{
+  // Hashing and sequence helpers shared by the samplers.
+
+  inline uint32_t hash(uint32_t x)
+  {
+    // lowbias32 (Wellons), a well-mixing 32-bit integer hash.
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  inline uint32_t hash_combine(uint32_t seed, uint32_t v)
+  {
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+  }
+
+  inline uint32_t pixel_seed(int x, int y, uint32_t salt)
+  {
+    return hash(hash_combine(hash(uint32_t(x) ^ salt), uint32_t(y)));
+  }
+
+  inline double to_unit(uint32_t bits)
+  {
+    // Maps 32 bits to [0, 1[. The largest double below 1 guards against
+    // rounding up.
+    return std::min(bits * (1.0 / 4294967296.0), 0x1.fffffffffffffp-1);
+  }
+
+  inline uint32_t reverse_bits(uint32_t x)
+  {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+  {
+    // Owen scrambling by hashing (Burley, "Practical Hash-based Owen
+    // Scrambling", 2020): in bit-reversed order, a Laine-Karras style hash
+    // makes each bit depend only on the bits above it, which is exactly a
+    // random nested permutation of the elementary intervals.
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+  }
+
+  inline uint32_t sobol(uint32_t index, int dimension)
+  {
+    // First two dimensions of the Sobol sequence: the van der Corput
+    // sequence, and the dimension of primitive polynomial x + 1 with m1 = 1.
+    // Together they are a (0, 2)-sequence; further dimensions are padded from
+    // independently scrambled pairs instead.
+    //
+    // The generator matrix of the second is the Pascal matrix mod 2. By
+    // Lucas' theorem, entry (j, k) is odd exactly when the bits of j are a
+    // subset of those of k, so the product is an XOR over supersets that
+    // takes five shifts instead of a loop over the bits of the index.
+    if (dimension == 1)
+    {
+      index ^= (index >> 1) & 0x55555555u;
+      index ^= (index >> 2) & 0x33333333u;
+      index ^= (index >> 4) & 0x0f0f0f0fu;
+      index ^= (index >> 8) & 0x00ff00ffu;
+      index ^= (index >> 16) & 0x0000ffffu;
+    }
+    return reverse_bits(index);
+  }
+
+  inline sample2 owen_sobol_2d(uint32_t index, uint32_t seed)
+  {
+    // Shuffled and scrambled 2D Sobol point: the index is scrambled as well,
+    // so every seed gives an independent ordering of an independent
+    // randomization.
+    index = nested_uniform_scramble(index, seed);
+    return {to_unit(nested_uniform_scramble(sobol(index, 0),
+                                            hash_combine(seed, 0))),
+            to_unit(nested_uniform_scramble(sobol(index, 1),
+                                            hash_combine(seed, 1)))};
+  }
+
+  inline uint32_t permute(uint32_t i, uint32_t length, uint32_t seed)
+  {
+    // Element i of a random permutation of [0, length), without storing it
+    // (Kensler, "Correlated Multi-Jittered Sampling", 2013).
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+      i ^= seed;
+      i *= 0xe170893du;
+      i ^= seed >> 16;
+      i ^= (i & w) >> 4;
+      i ^= seed >> 8;
+      i *= 0x0929eb3fu;
+      i ^= seed >> 23;
+      i ^= (i & w) >> 1;
+      i *= 1 | seed >> 27;
+      i *= 0x6935fa69u;
+      i ^= (i & w) >> 11;
+      i *= 0x74dcb303u;
+      i ^= (i & w) >> 2;
+      i *= 0x9e501cc3u;
+      i ^= (i & w) >> 2;
+      i *= 0xc860a3dfu;
+      i &= w;
+      i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+  }
+
+  inline double jitter(uint32_t i, uint32_t seed)
+  {
+    return to_unit(hash(hash_combine(seed, i)));
+  }
+
+  class blue_noise_mask
+  {
+    // A 64x64 tile of ranks 0..4095 arranged as blue noise, built once by
+    // void-and-cluster (Ulichney, 1993): every threshold of the ranks gives
+    // evenly spread points, so neighbouring pixels get very different values.
+
+   public:
+    static const int size = 64;
+
+    static const blue_noise_mask& get()
+    {
+      static const blue_noise_mask mask;
+      return mask;
+    }
+
+    // Value in ]0, 1[ at (x, y), tiled over the plane.
+    double at(int x, int y) const
+    {
+      auto rank = ranks[(y & (size - 1)) * size + (x & (size - 1))];
+      return (rank + 0.5) / (size * size);
+    }
+
+   private:
+    std::vector<uint16_t> ranks;
+
+    blue_noise_mask() : ranks(size * size)
+    {
+      const int n = size * size;
+
+      // Toroidal Gaussian energy kernel, sigma 1.5, indexed by offset.
+      std::vector<double> kernel(n);
+      for (int dy = 0; dy < size; dy++)
+        for (int dx = 0; dx < size; dx++)
+        {
+          int ox = std::min(dx, size - dx), oy = std::min(dy, size - dy);
+          kernel[dy * size + dx] = std::exp(-(ox * ox + oy * oy) / 4.5);
+        }
+
+      std::vector<char> on(n, 0);
+      std::vector<double> energy(n, 0);
+      auto splat = [&](int p, double sign) {
+        int px = p % size, py = p / size;
+        for (int y = 0; y < size; y++)
+          for (int x = 0; x < size; x++)
+            energy[y * size + x] +=
+                sign * kernel[((y - py) & (size - 1)) * size +
+                              ((x - px) & (size - 1))];
+      };
+      auto extreme = [&](bool ones, bool highest) {
+        int best = -1;
+        for (int p = 0; p < n; p++)
+          if (bool(on[p]) == ones &&
+              (best < 0 || (highest ? energy[p] > energy[best]
+                                    : energy[p] < energy[best])))
+            best = p;
+        return best;
+      };
+
+      // Initial pattern: a tenth of the pixels, then moved from the tightest
+      // cluster to the largest void until that changes nothing.
+      uint32_t state = 1;
+      int initial = n / 10;
+      for (int placed = 0; placed < initial;)
+      {
+        state = hash(state + 1);
+        int p = int(state % n);
+        if (on[p]) continue;
+        on[p] = 1;
+        splat(p, 1);
+        placed++;
+      }
+      for (int iteration = 0; iteration < n; iteration++)
+      {
+        int cluster = extreme(true, true);
+        on[cluster] = 0;
+        splat(cluster, -1);
+        int gap = extreme(false, false);
+        on[gap] = 1;
+        splat(gap, 1);
+        if (gap == cluster) break;
+      }
+
+      auto initial_on = on;
+      auto initial_energy = energy;
+
+      // Ranks below the initial count: remove the tightest cluster first.
+      for (int rank = initial - 1; rank >= 0; rank--)
+      {
+        int cluster = extreme(true, true);
+        on[cluster] = 0;
+        splat(cluster, -1);
+        ranks[cluster] = uint16_t(rank);
+      }
+
+      // The rest: fill the largest void first.
+      on = initial_on;
+      energy = initial_energy;
+      for (int rank = initial; rank < n; rank++)
+      {
+        int gap = extreme(false, false);
+        on[gap] = 1;
+        splat(gap, 1);
+        ranks[gap] = uint16_t(rank);
+      }
+    }
+  };
+}  // namespace sampling
+
+class independent_sampler : public sampler
+{
+  // Uniform random numbers from a generator keyed on (pixel, sample). Every
+  // dimension takes four steps of the generator, 1D or 2D, so any dimension
+  // can be reached directly by jumping ahead.
+
+ private:
+  rng sample_start;
+  rng generator;
+
+ public:
+  std::unique_ptr<sampler> clone(int) const override
+  {
+    return std::make_unique<independent_sampler>();
+  }
+
+  void start_sample(int x, int y, int sample_index) override
+  {
+    auto pixel = (uint64_t(uint32_t(y)) << 32) | uint32_t(x);
+    sample_start.seed_for_sample(pixel, uint64_t(sample_index));
+    generator = sample_start;
+  }
+
+  void set_dimension(int dimension) override
+  {
+    generator = sample_start;
+    generator.advance(4 * uint64_t(dimension));
+  }
+
+  double get_1d() override
+  {
+    auto x = generator.next_double();
+    generator.advance(2);
+    return x;
+  }
+
+  sample2 get_2d() override
+  {
+    auto x = generator.next_double();
+    return {x, generator.next_double()};
+  }
+};
+
+class stratified_sampler : public sampler
+{
+  // Jittered strata: in every dimension, the samples of a pixel fall one per
+  // stratum, in a random order per pixel and dimension. 2D dimensions use
+  // correlated multi-jittering (Kensler 2013), which is stratified both on an
+  // m x n grid and along each axis for any sample count.
+
+ private:
+  int count = 1;
+  int grid_x = 1, grid_y = 1;
+  uint32_t pixel = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+
+  uint32_t seed()
+  {
+    // Samples past the pixel's count start a new, differently permuted round.
+    return sampling::hash_combine(
+        sampling::hash_combine(pixel, dimension++), index / uint32_t(count));
+  }
+
+ public:
+  stratified_sampler(int samples_per_pixel = 1)
+      : count(std::max(samples_per_pixel, 1))
+  {
+    grid_x = std::max(1, int(std::sqrt(double(count))));
+    grid_y = (count + grid_x - 1) / grid_x;
+  }
+
+  std::unique_ptr<sampler> clone(int samples_per_pixel) const override
+  {
+    return std::make_unique<stratified_sampler>(samples_per_pixel);
+  }
+
+  void start_sample(int x, int y, int sample_index) override
+  {
+    pixel = sampling::pixel_seed(x, y, 0x5eed1u);
+    index = uint32_t(sample_index);
+    dimension = 0;
+  }
+
+  void set_dimension(int d) override { dimension = uint32_t(d); }
+
+  double get_1d() override
+  {
+    auto p = seed();
+    auto s = sampling::permute(index % count, count, p);
+    return (s + sampling::jitter(index, p * 0x68bc21ebu)) / count;
+  }
+
+  sample2 get_2d() override
+  {
+    auto p = seed();
+    auto m = uint32_t(grid_x), n = uint32_t(grid_y);
+    auto s = sampling::permute(index % count, count, p * 0x51633e2du);
+    auto sx = sampling::permute(s % m, m, p * 0xa511e9b3u);
+    auto sy = sampling::permute(s / m, n, p * 0x63d83595u);
+    auto jx = sampling::jitter(index, p * 0xa399d265u);
+    auto jy = sampling::jitter(index, p * 0x711ad6a5u);
+    return {std::min((s % m + (sy + jx) / n) / m, 0x1.fffffffffffffp-1),
+            std::min((s / m + (sx + jy) / m) / n, 0x1.fffffffffffffp-1)};
+  }
+};
+
+class sobol_sampler : public sampler
+{
+  // Owen-scrambled Sobol points (Burley 2020). Each dimension, or pair of
+  // dimensions, is a 2D Sobol sequence with its own hash-based scrambling and
+  // shuffling, seeded by pixel and dimension. Every power-of-two prefix of
+  // the samples is stratified in each dimension and pair, and the
+  // independent randomization keeps dimensions uncorrelated.
+
+ private:
+  uint32_t pixel = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+
+ public:
+  std::unique_ptr<sampler> clone(int) const override
+  {
+    return std::make_unique<sobol_sampler>();
+  }
+
+  void start_sample(int x, int y, int sample_index) override
+  {
+    pixel = sampling::pixel_seed(x, y, 0x50b01u);
+    index = uint32_t(sample_index);
+    dimension = 0;
+  }
+
+  void set_dimension(int d) override { dimension = uint32_t(d); }
+
+  double get_1d() override
+  {
+    auto seed = sampling::hash(sampling::hash_combine(pixel, dimension++));
+    return sampling::owen_sobol_2d(index, seed).x;
+  }
+
+  sample2 get_2d() override
+  {
+    auto seed = sampling::hash(sampling::hash_combine(pixel, dimension++));
+    return sampling::owen_sobol_2d(index, seed);
+  }
+};
+
+class blue_noise_sampler : public sampler
+{
+  // Screen-space blue noise (after Heitz and Belcour 2019): every pixel
+  // walks the same Owen-scrambled Sobol points, shifted modulo 1 by a
+  // blue-noise value that changes from pixel to pixel. Each pixel keeps the
+  // stratification of the sequence, while the leftover error of neighbouring
+  // pixels is decorrelated into high frequencies, which looks finer and
+  // blurs away. Each dimension reads the mask at its own toroidal offset.
+
+ private:
+  int px = 0, py = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+
+  double shift(uint32_t salt) const
+  {
+    auto h = sampling::hash(sampling::hash_combine(dimension, salt));
+    return sampling::blue_noise_mask::get().at(px + int(h & 63),
+                                               py + int((h >> 6) & 63));
+  }
+
+  static double wrap(double v)
+  {
+    v -= std::floor(v);
+    return std::min(v, 0x1.fffffffffffffp-1);
+  }
+
+ public:
+  blue_noise_sampler() { sampling::blue_noise_mask::get(); }
+
+  std::unique_ptr<sampler> clone(int) const override
+  {
+    return std::make_unique<blue_noise_sampler>();
+  }
+
+  void start_sample(int x, int y, int sample_index) override
+  {
+    px = x;
+    py = y;
+    index = uint32_t(sample_index);
+    dimension = 0;
+  }
+
+  void set_dimension(int d) override { dimension = uint32_t(d); }
+
+  double get_1d() override
+  {
+    auto seed = sampling::hash(dimension + 0xb1ae0u);
+    auto u = sampling::owen_sobol_2d(index, seed);
+    auto v = wrap(u.x + shift(0));
+    dimension++;
+    return v;
+  }
+
+  sample2 get_2d() override
+  {
+    auto seed = sampling::hash(dimension + 0xb1ae0u);
+    auto u = sampling::owen_sobol_2d(index, seed);
+    sample2 v = {wrap(u.x + shift(0)), wrap(u.y + shift(1))};
+    dimension++;
+    return v;
+  }
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Batch kernels, such as the packet intersections of the primitives, are
+// plain loops over arrays in structure-of-arrays layout: one lane per
+// iteration, the whole computation in the body and no branches. The
+// compiler vectorizes such a loop for whatever width the target has and
+// keeps every intermediate in registers, where a kernel composed of one
+// loop per operation would store each intermediate to memory between them.
+//
+// A single vec3 stays three plain scalars: packing it into a vector register
+// wastes a lane, and the horizontal adds of dot() cost more than they save.
+
+// Compiles a kernel twice, for the baseline instruction set and for AVX2,
+// and has the loader pick the clone the CPU can run. Neither clone may use
+// FMA, so both round alike and renders do not depend on the machine. The
+// clones cannot be inlined: mark whole loops, not the helpers they call.
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define TOYRENDERER_DISPATCH __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef TOYRENDERER_DISPATCH
+#define TOYRENDERER_DISPATCH
+#endif
+
+#endif
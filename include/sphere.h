@@ -1,18 +1,23 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "fast_math.h"
 #include "hittable.h"
+#include "material.h"
+#include "material_table.h"
 #include "vec3.h"
 
 class sphere : public hittable
 {
  private:
   ray center;
-  double radius;
-  shared_ptr<material> mat;
+  real radius;
+  uint32_t mat_id;
+  uint32_t prim_id = new_primitive_id();
   aabb bbox;
+  real uv_density;  // The unit uv square spread evenly over the area
 
-  static void get_sphere_uv(const point3& p, double& u, double& v)
+  static void get_sphere_uv(const point3& p, real& u, real& v)
   {
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -21,8 +26,8 @@ class sphere : public hittable
     //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
     //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-    auto theta = std::acos(-p.y());
-    auto phi = std::atan2(-p.z(), p.x()) + pi;
+    auto theta = fast_acos(-p.y());
+    auto phi = fast_atan2(-p.z(), p.x()) + pi;
 
     u = phi / (2 * pi);
     v = theta / pi;
@@ -30,19 +35,23 @@ class sphere : public hittable
 
  public:
   // Stationnary sphere
-  sphere(const point3& center, double radius, shared_ptr<material> mat)
-      : center(center, vec3(0, 0, 0)), radius(std::fmax(0, radius)), mat(mat)
+  sphere(const point3& center, real radius, shared_ptr<material> mat)
+      : center(center, vec3(0, 0, 0)),
+        radius(std::fmax(0, radius)),
+        mat_id(material_table::add(mat)),
+        uv_density(1 / std::sqrt(area()))
   {
     auto rvec = vec3(radius, radius, radius);
     bbox = aabb(center - rvec, center + rvec);
   }
 
   // Moving sphere
-  sphere(const point3& center1, const point3& center2, double radius,
+  sphere(const point3& center1, const point3& center2, real radius,
          shared_ptr<material> mat)
       : center(center1, center2 - center1),
         radius(std::fmax(0, radius)),
-        mat(mat)
+        mat_id(material_table::add(mat)),
+        uv_density(1 / std::sqrt(area()))
   {
     auto rvec = vec3(radius, radius, radius);
     auto bbox1 = aabb(center.at(0) - rvec, center.at(0) + rvec);
@@ -50,7 +59,7 @@ class sphere : public hittable
     bbox = aabb(bbox1, bbox2);
   }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
   {
     auto current_center = center.at(r.time());
     vec3 oc = current_center - r.origin();
@@ -76,17 +85,96 @@ class sphere : public hittable
       }
     }
 
-    rec.t = root;
+    hit.t = root;
+    hit.object = this;
+    hit.prim_id = prim_id;
+
+    return true;
+  }
+
+  void intersect_packet(ray_packet& packet, uint32_t mask) const override
+  {
+    // The single-ray test on every lane at once, without branches: each lane
+    // solves for both roots and keeps the nearer one inside its interval.
+    const int n = ray_packet::size;
+    alignas(64) real roots[n];
+    alignas(64) real hits[n];  // 1 for lanes that hit, else 0
+
+    auto c0 = center.origin(), c1 = center.direction();
+    for (int k = 0; k < n; k++)
+    {
+      auto ocx = (c0.x() + packet.time[k] * c1.x()) - packet.ox[k];
+      auto ocy = (c0.y() + packet.time[k] * c1.y()) - packet.oy[k];
+      auto ocz = (c0.z() + packet.time[k] * c1.z()) - packet.oz[k];
+      auto dx = packet.dx[k], dy = packet.dy[k], dz = packet.dz[k];
+
+      auto a = dx * dx + dy * dy + dz * dz;
+      auto h = dx * ocx + dy * ocy + dz * ocz;
+      auto c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+      auto discriminant = h * h - a * c;
+
+      // Lanes that miss take the root of a negative number. The NaN fails
+      // every comparison below, and bitwise operators keep the conditions
+      // free of branches.
+      auto sqrt = std::sqrt(discriminant);
+      auto near = (h - sqrt) / a, far = (h + sqrt) / a;
+      bool near_in = (packet.tmin[k] < near) & (near < packet.tmax[k]);
+      bool far_in = (packet.tmin[k] < far) & (far < packet.tmax[k]);
+
+      roots[k] = near_in ? near : far;
+      hits[k] = (discriminant >= 0) & (near_in | far_in) ? 1.0 : 0.0;
+    }
+
+    for_each_lane(mask, [&](int k) {
+      if (hits[k] != 0) packet.record(k, {roots[k], this, prim_id, 0, 0});
+    });
+  }
+
+  bool occluded(const ray& r, interval ray_t) const override
+  {
+    vec3 oc = center.at(r.time()) - r.origin();
+    auto a = r.direction().length_squared();
+    auto h = dot(r.direction(), oc);
+    auto c = oc.length_squared() - radius * radius;
+    auto discriminant = h * h - a * c;
+
+    if (discriminant < 0) return false;
+
+    auto sqrt = std::sqrt(discriminant);
+    return ray_t.surrounds((h - sqrt) / a) || ray_t.surrounds((h + sqrt) / a);
+  }
+
+  void finalize(const ray& r, const ray_hit& hit,
+                hit_record& rec) const override
+  {
+    rec.t = hit.t;
     rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - current_center) / radius;
+    vec3 outward_normal = (rec.p - center.at(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat = mat;
-
-    return true;
+    rec.mat_id = mat_id;
+    rec.prim_id = prim_id;
+    rec.uv_density = uv_density;
   }
 
   aabb bounding_box() const override { return bbox; }
+
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
+  {
+    if (material_table::get(mat_id)->is_emissive()) emitters.push_back(this);
+  }
+
+  double area() const override { return 4 * pi * radius * radius; }
+
+  void sample_surface(real time, const sample2& u,
+                      hit_record& rec) const override
+  {
+    rec.normal = sample_uniform_sphere(u);
+    rec.p = center.at(time) + radius * rec.normal;
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_id = mat_id;
+    rec.prim_id = prim_id;
+  }
 };
 
 #endif
@@ -3,14 +3,20 @@
 
 #include "color.h"
 #include "common.h"
+#include "mipmap.h"
 #include "perlin.h"
-#include "rtw_stb_image.h"
+#include "texture_cache.h"
 
 class texture
 {
  public:
   ~texture() = default;
-  virtual color value(double u, double v, const point3& p) const = 0;
+
+  // The color at surface coordinates (u, v) and point p. `footprint` is the
+  // width of the area the lookup stands for, in uv units, for textures that
+  // filter over it; 0 asks for the value at the point.
+  virtual color value(double u, double v, const point3& p,
+                      double footprint) const = 0;
 };
 
 class solid_color : public texture
@@ -25,7 +31,8 @@ class solid_color : public texture
   {
   }
 
-  color value(double u, double v, const point3& p) const override
+  color value(double u, double v, const point3& p,
+              double footprint) const override
   {
     return albedo;
   }
@@ -51,7 +58,8 @@ class checker_texture : public texture
   {
   }
 
-  color value(double u, double v, const point3& p) const override
+  color value(double u, double v, const point3& p,
+              double footprint) const override
   {
     auto xInteger = int(std::floor(inv_scale * p.x()));
     auto yInteger = int(std::floor(inv_scale * p.y()));
@@ -59,35 +67,35 @@ class checker_texture : public texture
 
     bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-    return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+    return isEven ? even->value(u, v, p, footprint)
+                  : odd->value(u, v, p, footprint);
   }
 };
 
 class image_texture : public texture
 {
  public:
-  image_texture(const char* filename) : image(filename) {}
+  // The pyramid comes from the process's texture cache, shared with the
+  // other textures of the same file, and loads in the background.
+  image_texture(const char* filename,
+                texture_filter filter = texture_filter::trilinear)
+      : texels(texture_cache::global().load(filename)), filter(filter)
+  {
+  }
 
-  color value(double u, double v, const point3& p) const override
+  color value(double u, double v, const point3& p,
+              double footprint) const override
   {
     // If we have no texture data, then return solid cyan as a debugging aid.
-    if (image.height() <= 0) return color(0, 1, 1);
+    auto pyramid = texels->get();
+    if (pyramid == nullptr) return color(0, 1, 1);
 
-    // Clamp input texture coordinates to [0,1] x [1,0]
-    u = interval(0, 1).clamp(u);
-    v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
-
-    auto i = int(u * image.width());
-    auto j = int(v * image.height());
-    auto pixel = image.pixel_data(i, j);
-
-    auto color_scale = 1.0 / 255.0;
-    return color(color_scale * pixel[0], color_scale * pixel[1],
-                 color_scale * pixel[2]);
+    return pyramid->lookup(u, v, footprint, filter);
   }
 
  private:
-  rtw_image image;
+  texture_cache::handle texels;
+  texture_filter filter;
 };
 
 class noise_texture : public texture
@@ -95,15 +103,33 @@ class noise_texture : public texture
  private:
   perlin noise;
   double scale;
+  std::vector<noise_volume> baked;
 
  public:
   noise_texture(double scale) : scale(scale) {}
 
-  color value(double u, double v, const point3& p) const override
+  // Precomputes the turbulence inside `bounds` at `resolution` samples per
+  // unit, trading detail finer than that for faster lookups there. Each call
+  // adds a region; points outside all of them get the full turbulence.
+  void bake(const aabb& bounds, double resolution, thread_pool* pool = nullptr)
+  {
+    baked.emplace_back(noise, bounds, resolution, 7, pool);
+  }
+
+  color value(double u, double v, const point3& p,
+              double footprint) const override
   {
     //    return color(1,1,1) * 0.5 * (1.0 + noise.noise(scale * p));
     return color(.5, .5, .5) *
-           (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
+           (1 + std::sin(scale * p.z() + 10 * turbulence(p)));
+  }
+
+ private:
+  double turbulence(const point3& p) const
+  {
+    for (const auto& volume : baked)
+      if (volume.contains(p)) return volume.lookup(p);
+    return noise.turb(p, 7);
   }
 };
 #endif
@@ -0,0 +1,189 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mipmap.h"
+#include "rtw_stb_image.h"
+
+class texture_cache
+{
+  // Image files converted to mip pyramids, shared by every texture that
+  // names the same file, however it spells the path. A load returns at once
+  // and decodes on a thread of its own, so a scene that uses many images
+  // reads them all in parallel while it is still being built; a texture only
+  // waits for its pyramid on the first lookup before it is ready.
+  //
+  // With a tile directory set, each pyramid is also saved there in its tiled
+  // layout, and later loads of an unchanged file map that instead of
+  // decoding the image again: the render then pages in only the tiles and
+  // levels it reads, and the system can drop them again under pressure.
+  //
+  // Pyramids no texture uses any more stay cached for later scenes while
+  // the total fits the memory budget, and the least recently loaded go
+  // first once it does not. Pyramids in use are never dropped, so a scene
+  // that needs more than the budget still gets all its textures.
+
+ public:
+  class pyramid
+  {
+   public:
+    // Null if the image could not be loaded. Waits for the load to finish.
+    const mipmap* get() const { return result.get().get(); }
+
+    bool ready() const
+    {
+      return result.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    }
+
+   private:
+    friend class texture_cache;
+    std::shared_future<std::shared_ptr<const mipmap>> result;
+  };
+
+  using handle = std::shared_ptr<const pyramid>;
+
+  // Bytes of texels to keep cached beyond those in use.
+  size_t memory_budget = size_t(1) << 30;
+
+  // Where to save and map tiled pyramids; none if empty. The directory must
+  // exist. Set both before loading.
+  std::string tile_directory;
+
+  // The one cache of the process.
+  static texture_cache& global()
+  {
+    static texture_cache cache;
+    return cache;
+  }
+
+  // The pyramid of an image file, looked for where rtw_image looks.
+  handle load(const char* filename)
+  {
+    auto path = rtw_image::find(filename);
+    if (path.empty())
+    {
+      std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+      auto missing = std::make_shared<pyramid>();
+      std::promise<std::shared_ptr<const mipmap>> none;
+      none.set_value(nullptr);
+      missing->result = none.get_future().share();
+      return missing;
+    }
+
+    std::error_code error;
+    auto key = std::filesystem::weakly_canonical(path, error).string();
+    if (error) key = path;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& e = entries[key];
+    e.last_use = ++clock;
+    if (e.item) return e.item;
+
+    auto item = std::make_shared<pyramid>();
+    item->result = std::async(std::launch::async, build, key, tile_file(key))
+                       .share();
+    e.item = item;
+    evict();
+    return item;
+  }
+
+  // Drops what the memory budget no longer covers, as loads also do.
+  void trim()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    evict();
+  }
+
+  // Bytes of texels in the cache, not counting loads still running.
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t total = 0;
+    for (const auto& [key, e] : entries)
+      if (e.item->ready() && e.item->get()) total += e.item->get()->size();
+    return total;
+  }
+
+ private:
+  struct entry
+  {
+    handle item;
+    uint64_t last_use = 0;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<std::string, entry> entries;  // By canonical path
+  uint64_t clock = 0;
+
+  void evict()
+  {
+    // Callers hold the mutex.
+    size_t total = 0;
+    std::vector<std::pair<uint64_t, std::string>> idle;
+    for (const auto& [key, e] : entries)
+    {
+      if (!e.item->ready()) continue;  // Size not known yet
+      auto texels = e.item->get();
+      if (texels) total += texels->size();
+      if (e.item.use_count() == 1) idle.emplace_back(e.last_use, key);
+    }
+
+    std::sort(idle.begin(), idle.end());
+    for (const auto& [last_use, key] : idle)
+    {
+      if (total <= memory_budget) break;
+      auto texels = entries[key].item->get();
+      if (texels) total -= texels->size();
+      entries.erase(key);
+    }
+  }
+
+  std::string tile_file(const std::string& key) const
+  {
+    if (tile_directory.empty()) return "";
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016zx.mip",
+                  std::hash<std::string>()(key));
+    return (std::filesystem::path(tile_directory) / name).string();
+  }
+
+  static std::shared_ptr<const mipmap> build(std::string path,
+                                             std::string tile_file)
+  {
+    // A saved pyramid is current while the image keeps its size and time.
+    std::error_code error;
+    uint64_t stamp =
+        uint64_t(std::filesystem::file_size(path, error)) * 0x9e3779b97f4a7c15 ^
+        uint64_t(std::filesystem::last_write_time(path, error)
+                     .time_since_epoch()
+                     .count());
+
+    if (!tile_file.empty())
+      if (auto saved = mipmap::map(tile_file, stamp)) return saved;
+
+    auto texels = std::make_shared<mipmap>(rtw_image(path.c_str()));
+    if (texels->empty()) return nullptr;
+
+    // Saved, and then read back, so that the texels are pageable like those
+    // of later runs.
+    if (!tile_file.empty() && texels->write(tile_file, stamp))
+      if (auto saved = mipmap::map(tile_file, stamp)) return saved;
+    return texels;
+  }
+};
+
+#endif
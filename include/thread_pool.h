@@ -0,0 +1,238 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool
+{
+ public:
+  // A unit of work. The argument is the index of the worker running the task,
+  // in [0, size()), which callers can use to address per-worker scratch data.
+  using task = std::function<void(int)>;
+
+ private:
+  // Each worker owns a deque. The owner pushes and pops at the back (LIFO, so
+  // the most recently queued work is still warm in cache), while idle workers
+  // steal from the front, taking the oldest and usually largest pieces of work.
+  struct work_queue
+  {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<work_queue>> queues;
+
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::atomic<int> queued{0};  // Tasks sitting in any queue
+  bool stopping = false;
+
+  // Identify the pool and worker running on the current thread, if any.
+  inline static thread_local const thread_pool* current_pool = nullptr;
+  inline static thread_local int current_worker = -1;
+
+  int worker_index() const
+  {
+    return current_pool == this ? current_worker : -1;
+  }
+
+  bool pop(int index, task& out)
+  {
+    auto& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+
+    out = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queued--;
+    return true;
+  }
+
+  bool steal(int thief, task& out)
+  {
+    // Visit the other queues starting from our right-hand neighbour so that
+    // thieves spread out instead of all hammering queue 0.
+    int count = int(queues.size());
+    for (int offset = 1; offset < count; offset++)
+    {
+      auto& queue = *queues[(thief + offset) % count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) continue;
+
+      out = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      queued--;
+      return true;
+    }
+    return false;
+  }
+
+  void worker_loop(int index)
+  {
+    current_pool = this;
+    current_worker = index;
+
+    while (true)
+    {
+      task t;
+      if (pop(index, t) || steal(index, t))
+      {
+        t(index);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      wake.wait(lock, [this] { return stopping || queued > 0; });
+      if (stopping && queued == 0) return;
+    }
+  }
+
+  void notify()
+  {
+    // Taking the lock orders the `queued` update before any waiter's predicate
+    // check, so a worker that is about to sleep can't miss the wake-up.
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_all();
+  }
+
+ public:
+  explicit thread_pool(int thread_count = 0)
+  {
+    // A thread count of 0 (or less) means one worker per hardware thread.
+    if (thread_count <= 0)
+      thread_count = int(std::thread::hardware_concurrency());
+    if (thread_count <= 0) thread_count = 1;
+
+    for (int i = 0; i < thread_count; i++)
+      queues.push_back(std::make_unique<work_queue>());
+
+    // A pool of one runs everything on the calling thread.
+    if (thread_count == 1) return;
+
+    for (int i = 0; i < thread_count; i++)
+      threads.emplace_back([this, i] { worker_loop(i); });
+  }
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads) thread.join();
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  int size() const { return int(queues.size()); }
+
+  void submit(task t)
+  {
+    // Tasks submitted from inside a worker land on that worker's own deque;
+    // anything else goes round-robin.
+    static std::atomic<unsigned> next_queue{0};
+    int index = worker_index() >= 0 ? worker_index()
+                                     : int(next_queue++ % queues.size());
+    if (threads.empty())
+    {
+      t(0);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queues[index]->mutex);
+      queues[index]->tasks.push_back(std::move(t));
+      queued++;
+    }
+    notify();
+  }
+
+  void parallel_for(int count, const std::function<void(int, int)>& fn)
+  {
+    // Calls fn(i, worker) for every i in [0, count) and blocks until all calls
+    // have returned. Indices are dealt out to the workers in contiguous blocks,
+    // so neighbouring items start on the same worker; load imbalance is then
+    // evened out by stealing.
+    //
+    // May be called from inside a pool task, which makes fork-join recursion
+    // possible: a worker waiting on nested work keeps running queued tasks
+    // instead of blocking, so the pool can't deadlock on itself.
+
+    if (count <= 0) return;
+
+    if (threads.empty())
+    {
+      for (int i = 0; i < count; i++) fn(i, 0);
+      return;
+    }
+
+    // Shared with the tasks, so the last one can still signal after the
+    // waiter has observed the count reach zero and returned.
+    struct completion
+    {
+      std::atomic<int> remaining;
+      std::mutex mutex;
+      std::condition_variable done;
+    };
+    auto state = std::make_shared<completion>();
+    state->remaining = count;
+
+    int worker_count = size();
+    for (int w = 0; w < worker_count; w++)
+    {
+      auto& queue = *queues[w];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+
+      // Pushed in reverse so the owner, popping from the back, walks its block
+      // front to back while thieves take from the far end.
+      int begin = int(int64_t(count) * w / worker_count);
+      int end = int(int64_t(count) * (w + 1) / worker_count);
+      for (int i = end - 1; i >= begin; i--)
+      {
+        queue.tasks.push_back([&fn, state, i](int worker) {
+          fn(i, worker);
+          if (--state->remaining == 0)
+          {
+            std::lock_guard<std::mutex> done_lock(state->mutex);
+            state->done.notify_all();
+          }
+        });
+        queued++;
+      }
+    }
+    notify();
+
+    int me = worker_index();
+    if (me >= 0)
+    {
+      while (state->remaining > 0)
+      {
+        task t;
+        if (pop(me, t) || steal(me, t))
+          t(me);
+        else
+          std::this_thread::yield();
+      }
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->remaining == 0; });
+  }
+};
+
+#endif
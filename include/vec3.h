@@ -6,22 +6,34 @@
 
 #include "common.h"
 
-class vec3
+template <typename T>
+class vec3_t
 {
+  // Three components of scalar type T. The renderer uses vec3, on `real`;
+  // the other precision is there for data that wants it regardless.
+
  public:
-  double e[3];
-  vec3() : e{0, 0, 0} {}
-  vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+  using scalar = T;
+
+  T e[3];
+  vec3_t() : e{0, 0, 0} {}
+  vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-  double x() const { return e[0]; }
-  double y() const { return e[1]; }
-  double z() const { return e[2]; }
+  // Conversion from the other precision, which has to be asked for.
+  template <typename U>
+  explicit vec3_t(const vec3_t<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])}
+  {
+  }
 
-  vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-  double operator[](int i) const { return e[i]; }
-  double& operator[](int i) { return e[i]; }
+  T x() const { return e[0]; }
+  T y() const { return e[1]; }
+  T z() const { return e[2]; }
 
-  vec3& operator+=(const vec3& v)
+  vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+  T operator[](int i) const { return e[i]; }
+  T& operator[](int i) { return e[i]; }
+
+  vec3_t& operator+=(const vec3_t& v)
   {
     e[0] += v.e[0];
     e[1] += v.e[1];
@@ -29,7 +41,7 @@ class vec3
     return *this;
   }
 
-  vec3& operator*=(double t)
+  vec3_t& operator*=(T t)
   {
     e[0] *= t;
     e[1] *= t;
@@ -37,82 +49,105 @@ class vec3
     return *this;
   }
 
-  vec3& operator/=(double t) { return *this *= 1 / t; }
+  vec3_t& operator/=(T t) { return *this *= 1 / t; }
 
-  double length() const { return std::sqrt(length_squared()); }
+  T length() const { return std::sqrt(length_squared()); }
 
-  double length_squared() const
-  {
-    return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
-  }
+  T length_squared() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
 
   bool near_zero() const
   {
     auto s = 1e-8;
-    return (std::fabs(e[0] < s)) && (std::fabs(e[1] < s)) &&
-           (std::fabs(e[2] < s));
+    return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) &&
+           (std::fabs(e[2]) < s);
   }
 
-  static vec3 random()
+  static vec3_t random()
   {
-    return vec3(random_double(), random_double(), random_double());
+    return vec3_t(T(random_double()), T(random_double()), T(random_double()));
   }
 
-  static vec3 random(double min, double max)
+  static vec3_t random(double min, double max)
   {
-    return vec3(random_double(min, max), random_double(min, max),
-                random_double(min, max));
+    return vec3_t(T(random_double(min, max)), T(random_double(min, max)),
+                  T(random_double(min, max)));
   }
 };
 
+using vec3 = vec3_t<real>;
+using vec3f = vec3_t<float>;
+using vec3d = vec3_t<double>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the
 // code.
 using point3 = vec3;
 
 // Vector Utility Functions
+//
+// Scalar arguments take the vector's scalar type, named through the vector
+// so it is not deduced from them: 0.5 * v then works for either precision.
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v)
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v)
 {
   return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-  return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+  return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-  return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+  return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-  return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+  return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v)
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T>& v)
 {
-  return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+  return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, double t) { return t * v; }
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, typename vec3_t<T>::scalar t)
+{
+  return t * v;
+}
 
-inline vec3 operator/(const vec3& v, double t) { return (1 / t) * v; }
+template <typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, typename vec3_t<T>::scalar t)
+{
+  return (1 / t) * v;
+}
 
-inline double dot(const vec3& u, const vec3& v)
+template <typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v)
 {
   return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3& u, const vec3& v)
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-  return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-              u.e[2] * v.e[0] - u.e[0] * v.e[2],
-              u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+  return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                   u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                   u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(const vec3& v) { return v / v.length(); }
+template <typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v)
+{
+  return v / v.length();
+}
 
 inline vec3 random_unit_vector()
 {
@@ -149,14 +184,17 @@ inline vec3 random_in_unit_disk()
   }
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n)
+template <typename T>
+inline vec3_t<T> reflect(const vec3_t<T>& v, const vec3_t<T>& n)
 {
   return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat)
+template <typename T>
+inline vec3_t<T> refract(const vec3_t<T>& uv, const vec3_t<T>& n,
+                         typename vec3_t<T>::scalar etai_over_etat)
 {
-  auto cos_theta = std::fmin(1.0, dot(-uv, n));
+  auto cos_theta = std::fmin(T(1), dot(-uv, n));
   auto r_perpendicular = etai_over_etat * (uv + cos_theta * n);
   auto r_parallel =
       -std::sqrt(std::fabs(1 - r_perpendicular.length_squared())) * n;
@@ -164,4 +202,4 @@ inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat)
   return r_perpendicular + r_parallel;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,57 @@
+#ifndef WARP_H
+#define WARP_H
+
+#include "common.h"
+
+struct sample2
+{
+  // A point in the unit square, [0, 1[ on each axis, from a sampler.
+  double x, y;
+};
+
+// Warps from the unit square onto other domains. Each is a continuous
+// one-to-one map that uses exactly the two numbers it is given, unlike
+// rejection sampling, so the stratification of low-discrepancy samples
+// carries over to the warped points.
+
+inline vec3 sample_concentric_disk(const sample2& u)
+{
+  // Shirley-Chiu concentric map: squares around the centre of [-1, 1]^2 go
+  // to rings, which keeps areas and neighbourhoods. Returns a point in the
+  // z = 0 plane.
+  auto a = 2 * u.x - 1, b = 2 * u.y - 1;
+  if (a == 0 && b == 0) return vec3(0, 0, 0);
+
+  double r, theta;
+  if (std::fabs(a) > std::fabs(b))
+  {
+    r = a;
+    theta = (pi / 4) * (b / a);
+  }
+  else
+  {
+    r = b;
+    theta = (pi / 2) - (pi / 4) * (a / b);
+  }
+  return vec3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
+inline vec3 sample_uniform_sphere(const sample2& u)
+{
+  // Archimedes: z is uniform over [-1, 1] on a uniform sphere.
+  auto z = 1 - 2 * u.x;
+  auto r = std::sqrt(std::fmax(0.0, 1 - z * z));
+  auto phi = 2 * pi * u.y;
+  return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline vec3 sample_cosine_hemisphere(const sample2& u)
+{
+  // Malley's method: a uniform disk point lifted onto the hemisphere around
+  // +z has density cos(theta) / pi.
+  auto d = sample_concentric_disk(u);
+  auto z = std::sqrt(std::fmax(0.0, 1 - d.x() * d.x() - d.y() * d.y()));
+  return vec3(d.x(), d.y(), z);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+
+// Structure-of-arrays queues for the wavefront integrator. A wave holds
+// many paths that advance one stage at a time, and each stage reads only
+// the arrays it needs, walking them in order.
+
+struct ray_queue
+{
+  std::vector<real> ox, oy, oz;  // Origins
+  std::vector<real> dx, dy, dz;  // Directions
+  std::vector<real> time;
+
+  void resize(size_t n)
+  {
+    for (auto v : {&ox, &oy, &oz, &dx, &dy, &dz, &time}) v->resize(n);
+  }
+
+  void set(size_t i, const ray& r)
+  {
+    ox[i] = r.origin().x();
+    oy[i] = r.origin().y();
+    oz[i] = r.origin().z();
+    dx[i] = r.direction().x();
+    dy[i] = r.direction().y();
+    dz[i] = r.direction().z();
+    time[i] = r.time();
+  }
+
+  ray get(size_t i) const
+  {
+    return ray(point3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]),
+               time[i]);
+  }
+};
+
+struct color_queue
+{
+  std::vector<real> r, g, b;
+
+  void resize(size_t n)
+  {
+    r.resize(n);
+    g.resize(n);
+    b.resize(n);
+  }
+
+  void set(size_t i, const color& c)
+  {
+    r[i] = c.x();
+    g[i] = c.y();
+    b[i] = c.z();
+  }
+
+  color get(size_t i) const { return color(r[i], g[i], b[i]); }
+
+  void add(size_t i, const color& c)
+  {
+    r[i] += c.x();
+    g[i] += c.y();
+    b[i] += c.z();
+  }
+};
+
+struct path_queue
+{
+  // The paths of a wave, by slot. A slot keeps its path for the whole wave;
+  // the stages work through lists of the slots still active.
+  ray_queue rays;
+  color_queue throughput;
+  color_queue radiance;
+  std::vector<real> scattering_pdf;
+  std::vector<real> cone_width, cone_spread;  // Texture footprint cones
+  std::vector<hit_record> hits;
+
+  std::vector<int> pixel;   // Index of the pixel in the tile
+  std::vector<int> sample;  // Sample index within the pixel
+
+  void resize(size_t n)
+  {
+    rays.resize(n);
+    throughput.resize(n);
+    radiance.resize(n);
+    scattering_pdf.resize(n);
+    cone_width.resize(n);
+    cone_spread.resize(n);
+    hits.resize(n);
+    pixel.resize(n);
+    sample.resize(n);
+  }
+};
+
+struct shadow_queue
+{
+  // Light samples waiting on their visibility test. An unblocked ray adds
+  // its contribution to the radiance of its path.
+  ray_queue rays;
+  std::vector<real> distance;
+  color_queue contribution;
+  std::vector<uint32_t> path;  // Slot of the path that cast the ray
+
+  size_t size() const { return path.size(); }
+
+  void clear() { path.clear(); }
+
+  void push(uint32_t slot, const ray& r, real max_distance, const color& c)
+  {
+    auto i = path.size();
+    path.push_back(slot);
+    if (distance.size() <= i)
+    {
+      rays.resize(i + 1);
+      contribution.resize(i + 1);
+      distance.resize(i + 1);
+    }
+    rays.set(i, r);
+    distance[i] = max_distance;
+    contribution.set(i, c);
+  }
+};
+
+#endif
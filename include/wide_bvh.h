@@ -0,0 +1,475 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// SIMD kernels use GCC/Clang target attributes for runtime dispatch.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TOYRENDERER_X86 1
+#include <immintrin.h>
+#endif
+
+#include "linear_bvh.h"
+
+// Ray data prepared once per ray for the wide slab tests: single precision
+// origin and reciprocal direction, so no node test divides.
+//
+// Rounding the origin moves every slab distance by up to the rounding error
+// times the reciprocal, which far from the scene origin is larger than the
+// float error of the distance itself; pad holds that shift per axis. The
+// kernels widen each slab interval by it, and the final interval by
+// wide_slack of its own size for the rounding of the subtraction, reciprocal
+// and product, so a box is never missed that the double precision test would
+// enter. Deferring the relative part to the end is sound because each pad
+// carries a larger relative margin of its own.
+struct wide_ray
+{
+  float origin[3];
+  float inv_dir[3];
+  float pad[3];
+};
+
+constexpr float wide_slack = 4 * std::numeric_limits<float>::epsilon();
+
+template <int N>
+struct alignas(64) wide_bvh_node
+{
+  // Child boxes in structure-of-arrays layout, one SIMD register per bound:
+  // bounds[0..2] hold the minimum x, y, z and bounds[3..5] the maximum x, y, z
+  // of all N children.
+  float bounds[6][N];
+
+  // Interior child: index of its node. Leaf child: index of its first
+  // primitive, with count[k] > 0 primitives.
+  uint32_t child[N];
+  uint16_t count[N];
+  uint8_t child_count;  // Slots [0, child_count) are in use
+};
+
+namespace wide_bvh_kernels
+{
+  // Each kernel tests the ray against every child box of a node and returns a
+  // bitmask of the children it enters within [tmin, tmax], writing the entry
+  // distance of each child to tnear.
+
+  template <int N>
+  inline int intersect_scalar(const wide_bvh_node<N>& node, const wide_ray& r,
+                              float tmin, float tmax, float* tnear)
+  {
+    int mask = 0;
+    for (int k = 0; k < node.child_count; k++)
+    {
+      float t_enter = tmin, t_exit = tmax;
+      for (int a = 0; a < 3; a++)
+      {
+        float t0 = (node.bounds[a][k] - r.origin[a]) * r.inv_dir[a];
+        float t1 = (node.bounds[a + 3][k] - r.origin[a]) * r.inv_dir[a];
+        if (t0 > t1) std::swap(t0, t1);
+        t0 -= r.pad[a];
+        t1 += r.pad[a];
+        t_enter = t0 > t_enter ? t0 : t_enter;
+        t_exit = t1 < t_exit ? t1 : t_exit;
+      }
+      t_enter -= wide_slack * std::fabs(t_enter);
+      t_exit += wide_slack * std::fabs(t_exit);
+      tnear[k] = t_enter;
+      if (t_enter <= t_exit) mask |= 1 << k;
+    }
+    return mask;
+  }
+
+#ifdef TOYRENDERER_X86
+  // SSE is part of the x86-64 baseline, so the 4-wide kernel needs no
+  // dispatch. Operand order matters: min/max return their second operand
+  // when either is NaN (0 * inf from a ray grazing a slab), which keeps the
+  // running interval instead of poisoning it. The padding passes NaN on to
+  // those same min/max.
+  inline int intersect_sse(const wide_bvh_node<4>& node, const wide_ray& r,
+                           float tmin, float tmax, float* tnear)
+  {
+    __m128 t_enter = _mm_set1_ps(tmin);
+    __m128 t_exit = _mm_set1_ps(tmax);
+    const __m128 slack = _mm_set1_ps(wide_slack);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    for (int a = 0; a < 3; a++)
+    {
+      __m128 o = _mm_set1_ps(r.origin[a]);
+      __m128 inv = _mm_set1_ps(r.inv_dir[a]);
+      __m128 pad = _mm_set1_ps(r.pad[a]);
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a]), o), inv);
+      __m128 t1 =
+          _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + 3]), o), inv);
+      t_enter = _mm_max_ps(_mm_sub_ps(_mm_min_ps(t0, t1), pad), t_enter);
+      t_exit = _mm_min_ps(_mm_add_ps(_mm_max_ps(t0, t1), pad), t_exit);
+    }
+    t_enter = _mm_sub_ps(
+        t_enter, _mm_mul_ps(slack, _mm_andnot_ps(sign, t_enter)));
+    t_exit = _mm_add_ps(t_exit, _mm_mul_ps(slack, _mm_andnot_ps(sign, t_exit)));
+
+    _mm_storeu_ps(tnear, t_enter);
+    int mask = _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+    return mask & ((1 << node.child_count) - 1);
+  }
+
+  __attribute__((target("avx"))) inline int intersect_avx(
+      const wide_bvh_node<8>& node, const wide_ray& r, float tmin, float tmax,
+      float* tnear)
+  {
+    __m256 t_enter = _mm256_set1_ps(tmin);
+    __m256 t_exit = _mm256_set1_ps(tmax);
+    const __m256 slack = _mm256_set1_ps(wide_slack);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    for (int a = 0; a < 3; a++)
+    {
+      __m256 o = _mm256_set1_ps(r.origin[a]);
+      __m256 inv = _mm256_set1_ps(r.inv_dir[a]);
+      __m256 pad = _mm256_set1_ps(r.pad[a]);
+      __m256 t0 = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(node.bounds[a]), o), inv);
+      __m256 t1 = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3]), o), inv);
+      t_enter =
+          _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(t0, t1), pad), t_enter);
+      t_exit =
+          _mm256_min_ps(_mm256_add_ps(_mm256_max_ps(t0, t1), pad), t_exit);
+    }
+    t_enter = _mm256_sub_ps(
+        t_enter, _mm256_mul_ps(slack, _mm256_andnot_ps(sign, t_enter)));
+    t_exit = _mm256_add_ps(
+        t_exit, _mm256_mul_ps(slack, _mm256_andnot_ps(sign, t_exit)));
+
+    _mm256_storeu_ps(tnear, t_enter);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ));
+    return mask & ((1 << node.child_count) - 1);
+  }
+
+  inline bool cpu_has_avx()
+  {
+    static const bool has_avx = __builtin_cpu_supports("avx");
+    return has_avx;
+  }
+#endif
+
+  template <int N>
+  using function = int (*)(const wide_bvh_node<N>&, const wide_ray&, float,
+                           float, float*);
+
+  template <int N>
+  inline function<N> select()
+  {
+    // Picks the widest kernel the running CPU supports for this node width.
+#ifdef TOYRENDERER_X86
+    if constexpr (N == 4) return intersect_sse;
+    if constexpr (N == 8)
+      if (cpu_has_avx()) return intersect_avx;
+#endif
+    return intersect_scalar<N>;
+  }
+}  // namespace wide_bvh_kernels
+
+template <int N>
+class wide_bvh : public hittable
+{
+  // An N-ary BVH built by collapsing the binary linear_bvh: each node pulls
+  // up grandchildren until it holds N children, so a single SIMD slab test
+  // replaces several binary levels. Children that are hit are visited nearest
+  // entry first, and deferred children are skipped once a hit closer than
+  // their entry distance is found.
+
+  static_assert(N == 4 || N == 8, "wide BVH nodes are 4 or 8 wide");
+
+ private:
+  struct stack_entry
+  {
+    uint32_t index;  // Node index, or first primitive for a leaf
+    uint16_t count;  // Primitive count, 0 for a node
+    float tnear;
+  };
+
+  // Every level can defer at most N - 1 children, and collapsing never makes
+  // the tree deeper than its binary source.
+  static const int stack_size = 64 * (N - 1) + 1;
+
+  std::vector<wide_bvh_node<N>> nodes;
+  std::vector<shared_ptr<hittable>> primitives;
+  aabb bbox;
+  bvh_build_stats stats;
+  wide_bvh_kernels::function<N> intersect_children;
+
+  struct source_child
+  {
+    uint32_t index;  // Binary node index
+    float area;
+  };
+
+  static float area(const linear_bvh_node& n)
+  {
+    float dx = n.bounds_max[0] - n.bounds_min[0];
+    float dy = n.bounds_max[1] - n.bounds_min[1];
+    float dz = n.bounds_max[2] - n.bounds_min[2];
+    return dx * dy + dy * dz + dz * dx;
+  }
+
+  uint32_t collapse(const std::vector<linear_bvh_node>& binary, uint32_t root)
+  {
+    // Converts the binary subtree at `root` (an interior node) into wide nodes
+    // and returns the index of the top one.
+
+    auto node_index = uint32_t(nodes.size());
+    nodes.emplace_back();
+
+    // Open up the interior child with the largest surface area, the one most
+    // likely to be entered, until the node is full or only leaves remain.
+    source_child children[N];
+    int count = 0;
+    const auto& r = binary[root];
+    children[count++] = {root + 1, area(binary[root + 1])};
+    children[count++] = {r.offset, area(binary[r.offset])};
+
+    while (count < N)
+    {
+      int best = -1;
+      for (int k = 0; k < count; k++)
+        if (binary[children[k].index].prim_count == 0 &&
+            (best < 0 || children[k].area > children[best].area))
+          best = k;
+      if (best < 0) break;
+
+      auto open = children[best].index;
+      children[best] = {open + 1, area(binary[open + 1])};
+      auto second = binary[open].offset;
+      children[count++] = {second, area(binary[second])};
+    }
+
+    nodes[node_index].child_count = uint8_t(count);
+    for (int k = 0; k < N; k++)
+    {
+      // Unused slots get inverted boxes, though the child count already keeps
+      // kernels from reporting them.
+      for (int a = 0; a < 3; a++)
+      {
+        nodes[node_index].bounds[a][k] = INFINITY;
+        nodes[node_index].bounds[a + 3][k] = -INFINITY;
+      }
+      nodes[node_index].child[k] = 0;
+      nodes[node_index].count[k] = 0;
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+      const auto& c = binary[children[k].index];
+      for (int a = 0; a < 3; a++)
+      {
+        nodes[node_index].bounds[a][k] = c.bounds_min[a];
+        nodes[node_index].bounds[a + 3][k] = c.bounds_max[a];
+      }
+
+      if (c.prim_count > 0)
+      {
+        nodes[node_index].child[k] = c.offset;
+        nodes[node_index].count[k] = c.prim_count;
+        stats.leaf_count++;
+      }
+      else
+      {
+        // Recursion may reallocate `nodes`, so write through the index.
+        auto child = collapse(binary, children[k].index);
+        nodes[node_index].child[k] = child;
+      }
+    }
+
+    return node_index;
+  }
+
+  static wide_ray prepare(const ray& r)
+  {
+    wide_ray wr;
+    for (int a = 0; a < 3; a++)
+    {
+      double origin = r.origin()[a];
+      double inv_dir = 1 / double(r.direction()[a]);
+      wr.origin[a] = float(origin);
+      wr.inv_dir[a] = float(inv_dir);
+
+      // The origin's rounding error is known exactly; the margin covers the
+      // rounding of the product and exceeds wide_slack. An axis the ray runs
+      // parallel to needs none: its slab distances are infinite either way.
+      double shift = std::fabs(double(wr.origin[a]) - origin);
+      wr.pad[a] = shift == 0 || std::isinf(inv_dir)
+                      ? 0
+                      : float(shift * std::fabs(inv_dir) * (1 + 1e-5));
+    }
+    return wr;
+  }
+
+ public:
+  wide_bvh(const hittable_list& list,
+           const bvh_build_options& options = bvh_build_options())
+      : intersect_children(wide_bvh_kernels::select<N>())
+  {
+    linear_bvh binary(list, options);
+    const auto& binary_nodes = binary.node_array();
+    if (binary_nodes.empty()) return;
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    primitives = binary.primitive_array();
+    bbox = binary.bounding_box();
+
+    if (binary_nodes[0].prim_count > 0)
+    {
+      // The whole scene is a single leaf: give it a one-child root.
+      nodes.emplace_back();
+      auto& root = nodes[0];
+      root.child_count = 1;
+      for (int a = 0; a < 3; a++)
+      {
+        root.bounds[a][0] = binary_nodes[0].bounds_min[a];
+        root.bounds[a + 3][0] = binary_nodes[0].bounds_max[a];
+      }
+      root.child[0] = 0;
+      root.count[0] = binary_nodes[0].prim_count;
+      stats.leaf_count = 1;
+    }
+    else
+    {
+      collapse(binary_nodes, 0);
+    }
+
+    nodes.shrink_to_fit();
+
+    // Tree shape statistics are the binary build's; the SAH cost model only
+    // describes binary trees.
+    stats.node_count = nodes.size();
+    stats.max_depth = binary.build_stats().max_depth;
+    stats.sah_cost = binary.build_stats().sah_cost;
+    stats.build_ms = binary.build_stats().build_ms +
+                     std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+  }
+
+  bool intersect(const ray& r, interval ray_t, ray_hit& hit) const override
+  {
+    if (nodes.empty()) return false;
+
+    auto wr = prepare(r);
+
+    stack_entry stack[stack_size];
+    int stack_top = 0;
+    const float tmin = linear_bvh::round_down(ray_t.min);
+    float tmax = linear_bvh::round_up(ray_t.max);
+    stack[stack_top++] = {0, 0, tmin};
+    bool hit_anything = false;
+    bvh_stats::ray();
+
+    while (stack_top > 0)
+    {
+      auto entry = stack[--stack_top];
+      if (entry.tnear > ray_t.max) continue;
+
+      if (entry.count > 0)
+      {
+        for (uint32_t i = 0; i < entry.count; i++)
+        {
+          if (primitives[entry.index + i]->intersect(r, ray_t, hit))
+          {
+            hit_anything = true;
+            ray_t.max = hit.t;
+            tmax = linear_bvh::round_up(ray_t.max);
+          }
+        }
+        continue;
+      }
+
+      const auto& node = nodes[entry.index];
+      bvh_stats::visit(&node);
+      float tnear[N];
+      int mask = intersect_children(node, wr, tmin, tmax, tnear);
+      if (mask == 0) continue;
+
+      // Push the hit children farthest first, so the nearest is popped next.
+      int first = stack_top;
+      for (int k = 0; k < node.child_count; k++)
+      {
+        if (!(mask & (1 << k))) continue;
+
+        stack_entry e = {node.child[k], node.count[k], tnear[k]};
+        int pos = stack_top++;
+        while (pos > first && stack[pos - 1].tnear < e.tnear)
+        {
+          stack[pos] = stack[pos - 1];
+          pos--;
+        }
+        stack[pos] = e;
+      }
+    }
+
+    return hit_anything;
+  }
+
+  bool occluded(const ray& r, interval ray_t) const override
+  {
+    // Any hit will do, so hit children are pushed unsorted and the search
+    // stops at the first primitive that blocks the ray.
+    if (nodes.empty()) return false;
+
+    auto wr = prepare(r);
+    const float tmin = linear_bvh::round_down(ray_t.min);
+    const float tmax = linear_bvh::round_up(ray_t.max);
+
+    stack_entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = {0, 0, tmin};
+    bvh_stats::ray();
+
+    while (stack_top > 0)
+    {
+      auto entry = stack[--stack_top];
+
+      if (entry.count > 0)
+      {
+        for (uint32_t i = 0; i < entry.count; i++)
+          if (primitives[entry.index + i]->occluded(r, ray_t)) return true;
+        continue;
+      }
+
+      const auto& node = nodes[entry.index];
+      bvh_stats::visit(&node);
+      float tnear[N];
+      int mask = intersect_children(node, wr, tmin, tmax, tnear);
+      for (int k = 0; k < node.child_count; k++)
+        if (mask & (1 << k))
+          stack[stack_top++] = {node.child[k], node.count[k], tnear[k]};
+    }
+
+    return false;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_emitters(std::vector<const hittable*>& emitters) const override
+  {
+    for (const auto& primitive : primitives)
+      primitive->gather_emitters(emitters);
+  }
+
+  const bvh_build_stats& build_stats() const { return stats; }
+
+  size_t memory_bytes() const
+  {
+    return nodes.size() * sizeof(wide_bvh_node<N>) +
+           primitives.size() * sizeof(shared_ptr<hittable>);
+  }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
@@ -3,6 +3,7 @@
 #include "material.h"
 #include "quad.h"
 #include "sphere.h"
+#include "wide_bvh.h"
 
 void bouncing_spheres()
 {
@@ -59,7 +60,9 @@ void bouncing_spheres()
   auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
   world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
-  world = hittable_list(make_shared<bvh_node>(world));
+  auto bvh = make_shared<bvh8>(world);
+  std::clog << bvh->build_stats() << '\n';
+  world = hittable_list(bvh);
 
   camera cam;
 
@@ -139,6 +142,13 @@ void perlin_spheres()
   hittable_list world;
 
   auto pertext = make_shared<noise_texture>(4);
+  {
+    // Most lookups land on the small sphere and on the ground around it,
+    // which within 8 units of the origin dips less than 0.07 below y = 0.
+    thread_pool pool;
+    pertext->bake(aabb(point3(-2, 0, -2), point3(2, 4, 2)), 32, &pool);
+    pertext->bake(aabb(point3(-8, -0.07, -8), point3(8, 0.01, 8)), 32, &pool);
+  }
   world.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
                                 make_shared<lambertian>(pertext)));
   world.add(make_shared<sphere>(point3(0, 2, 0), 2,
@@ -251,7 +261,7 @@ void cornell_box() {
 
     cam.aspect_ratio      = 1.0;
     cam.image_width       = 600;
-    cam.samples_per_pixel = 200;
+    cam.samples_per_pixel = 64;
     cam.max_depth         = 50;
     cam.background        = color(0,0,0);
 
@@ -0,0 +1,90 @@
+// Traces random rays through the same scene with linear_bvh and with the wide
+// BVHs, whose slab tests run in single precision, and checks that they find
+// the same closest hits and agree on occlusion. The scene sits far from the
+// origin, where rounding a ray's origin to float shifts its slab distances
+// by more than the distances' own rounding error.
+
+#include <cstdio>
+
+#include "common.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "wide_bvh.h"
+
+static int check(double offset, int ray_count)
+{
+  thread_rng().seed(7);
+
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  hittable_list world;
+  std::vector<point3> anchors;
+  auto base = point3(offset, offset, offset);
+  for (int i = 0; i < 4000; i++)
+  {
+    auto center = base + vec3::random(-10, 10);
+    world.add(make_shared<sphere>(center, random_double(0.05, 2), mat));
+    anchors.push_back(center);
+  }
+  for (int i = 0; i < 500; i++)
+  {
+    auto corner = base + vec3::random(-10, 10);
+    world.add(make_shared<quad>(corner, vec3::random(-3, 3),
+                                vec3::random(-3, 3), mat));
+    anchors.push_back(corner);
+  }
+
+  linear_bvh reference(world);
+  bvh4 four(world);
+  bvh8 eight(world);
+
+  int failures = 0;
+  for (int i = 0; i < ray_count; i++)
+  {
+    // Rays start near a primitive, where the origin's rounding matters most.
+    auto origin = anchors[random_int(0, int(anchors.size()) - 1)] +
+                  vec3::random(-3, 3);
+    ray r(origin, random_unit_vector());
+    interval ray_t(0.001, infinity);
+
+    ray_hit expected, got;
+    bool hit = reference.intersect(r, ray_t, expected);
+    bool blocked = reference.occluded(r, ray_t);
+
+    const hittable* wide[] = {&four, &eight};
+    const char* names[] = {"bvh4", "bvh8"};
+    for (int w = 0; w < 2; w++)
+    {
+      bool wide_hit = wide[w]->intersect(r, ray_t, got);
+      bool wide_blocked = wide[w]->occluded(r, ray_t);
+      if (wide_hit != hit || (hit && got.t != expected.t) ||
+          wide_blocked != blocked)
+      {
+        if (failures++ < 10)
+          std::printf("offset %g ray %d: %s hit %d t %.8f occluded %d, "
+                      "linear_bvh hit %d t %.8f occluded %d\n",
+                      offset, i, names[w], wide_hit, wide_hit ? got.t : 0.0,
+                      wide_blocked, hit, hit ? expected.t : 0.0, blocked);
+      }
+    }
+  }
+  return failures;
+}
+
+int main()
+{
+  // In single precision the primitives themselves lose the hit order far
+  // out, so only the near offsets can be compared there.
+#ifdef TOYRENDERER_SINGLE_PRECISION
+  const double offsets[] = {0.0, 1e3, 1e4};
+#else
+  const double offsets[] = {0.0, 1e4, 1e5, 1e6};
+#endif
+
+  int failures = 0;
+  for (double offset : offsets) failures += check(offset, 50000);
+
+  std::printf("%s: %d mismatches\n", failures ? "FAILED" : "passed", failures);
+  return failures ? 1 : 0;
+}
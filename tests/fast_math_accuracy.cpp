@@ -0,0 +1,65 @@
+// Sweeps the approximations of fast_math.h densely over their domains and
+// checks them against the double library functions, to the error bounds
+// their comments state for the precision of `real`.
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include "common.h"
+#include "fast_math.h"
+
+static int report(const char* name, double worst, double bound)
+{
+  bool ok = worst <= bound;
+  std::printf("%-10s worst %.3g, bound %.3g%s\n", name, worst, bound,
+              ok ? "" : "  FAILED");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+#ifdef TOYRENDERER_SINGLE_PRECISION
+  const double acos_bound = 5e-7, atan2_bound = 3e-7;
+#else
+  const double acos_bound = 3e-8, atan2_bound = 1e-8;
+#endif
+  const double epsilon = std::numeric_limits<real>::epsilon();
+  const int steps = 1 << 22;
+
+  // Absolute error over [-1, 1], ends included.
+  double worst = 0;
+  for (int i = 0; i <= steps; i++)
+  {
+    real x = real(-1 + 2.0 * i / steps);
+    worst = std::fmax(worst, std::fabs(fast_acos(x) - std::acos(double(x))));
+  }
+  int failures = report("fast_acos", worst, acos_bound);
+
+  // Absolute error around the circle, at radii from tiny to huge: the
+  // approximation only sees the ratio of the two, but rounds each.
+  worst = 0;
+  for (double radius : {1e-20, 1e-3, 1.0, 7.5, 1e5, 1e20})
+    for (int i = 0; i < steps; i++)
+    {
+      double angle = -pi + 2 * pi * (i + 0.5) / steps;
+      real y = real(radius * std::sin(angle));
+      real x = real(radius * std::cos(angle));
+      worst = std::fmax(worst, std::fabs(fast_atan2(y, x) -
+                                         std::atan2(double(y), double(x))));
+    }
+  if (fast_atan2(real(0), real(0)) != 0) worst = infinity;
+  failures += report("fast_atan2", worst, atan2_bound);
+
+  // Relative error in ulp over [0, 1], the range of the Schlick term.
+  worst = 0;
+  for (int i = 1; i <= steps; i++)
+  {
+    real x = real(double(i) / steps);
+    double exact = std::pow(double(x), 5);
+    worst = std::fmax(worst, std::fabs(pow5(x) - exact) / (exact * epsilon));
+  }
+  failures += report("pow5 (ulp)", worst, 4);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+// Checks the non-specular materials' scatter() against their eval() and
+// scattering_pdf() with the surface turned every way: normals along the
+// diagonals of all eight octants and in random directions, the view at a
+// fixed angle to each. Every sampled direction must have the density and
+// BSDF value the two report for it, and the mean weight of scatter() must
+// match eval() integrated over the hemisphere, and so must not depend on
+// how the frame is turned.
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "common.h"
+#include "material.h"
+#include "onb.h"
+
+static const int grid = 128;  // Stratified samples per axis
+
+static bool close(double a, double b, double tolerance)
+{
+  return std::fabs(a - b) <= tolerance * std::fmax(std::fabs(b), 1e-3);
+}
+
+static bool close(const color& a, const color& b, double tolerance)
+{
+  for (int c = 0; c < 3; c++)
+    if (!close(a[c], b[c], tolerance)) return false;
+  return true;
+}
+
+// The mean weight of scatter() and the integral of eval() for light arriving
+// at `normal` from `wo_local`, given in the normal's frame. Counts
+// disagreements of single samples into `failures`.
+static void measure(const material& m, const vec3& normal,
+                    const vec3& wo_local, color& weight, color& integral,
+                    int& failures)
+{
+  onb frame(normal);
+  auto wo = frame.transform(wo_local);
+  ray r_in(point3(0, 0, 0) + wo, -wo, 0);
+
+  hit_record rec;
+  rec.p = point3(0, 0, 0);
+  rec.set_face_normal(r_in, normal);
+  rec.u = rec.v = 0.5;
+
+  weight = integral = color(0, 0, 0);
+  for (int i = 0; i < grid; i++)
+    for (int j = 0; j < grid; j++)
+    {
+      sample2 u{(i + 0.5) / grid, (j + 0.5) / grid};
+
+      scatter_record srec;
+      if (m.scatter(r_in, rec, u, srec))
+      {
+        auto direction = srec.scattered.direction();
+        auto pdf = m.scattering_pdf(r_in, rec, direction);
+        auto bsdf = m.eval(r_in, rec, direction);
+        if (!(srec.pdf > 0) || !close(srec.pdf, pdf, 1e-6) ||
+            !close(srec.bsdf, bsdf, 1e-6))
+        {
+          if (failures++ < 10)
+            std::printf("normal (%g %g %g): sample pdf %g vs %g\n", normal.x(),
+                        normal.y(), normal.z(), srec.pdf, pdf);
+          continue;
+        }
+        weight += srec.bsdf / srec.pdf;
+      }
+
+      // Uniform over the hemisphere, where the density is 1 / 2pi.
+      auto cos_theta = u.x, phi = 2 * pi * u.y;
+      auto sin_theta = std::sqrt(1 - cos_theta * cos_theta);
+      auto direction = frame.transform(vec3(
+          std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta));
+      integral += m.eval(r_in, rec, direction) * (2 * pi);
+    }
+
+  weight /= grid * grid;
+  integral /= grid * grid;
+}
+
+int main()
+{
+  thread_rng().seed(11);
+
+  struct
+  {
+    const char* name;
+    shared_ptr<material> m;
+  } materials[] = {
+      {"lambertian", make_shared<lambertian>(color(.8, .6, .4))},
+      {"metal", make_shared<metal>(color(.9, .6, .3), 0.3)},
+      {"glossy", make_shared<glossy>(color(.2, .5, .8), 0.2)},
+  };
+
+  std::vector<vec3> normals{vec3(0, 0, 1)};
+  for (int k = 0; k < 8; k++)
+    normals.push_back(unit_vector(
+        vec3(k & 1 ? -1 : 1, k & 2 ? -1 : 1, k & 4 ? -1 : 1)));
+  for (int k = 0; k < 8; k++) normals.push_back(random_unit_vector());
+
+  const vec3 views[] = {unit_vector(vec3(0.2, 0, 1)),
+                        unit_vector(vec3(1, 0.5, 1)),
+                        unit_vector(vec3(1, 0, 0.25))};
+
+  int failures = 0;
+  for (const auto& [name, m] : materials)
+    for (const auto& wo_local : views)
+    {
+      color reference;
+      for (size_t k = 0; k < normals.size(); k++)
+      {
+        color weight, integral;
+        measure(*m, normals[k], wo_local, weight, integral, failures);
+        if (k == 0) reference = weight;
+
+        // The integral is of a peaked function over a coarse grid, while
+        // the frames should differ only in rounding.
+        bool ok = close(weight, integral, 0.01) &&
+                  close(weight, reference, 1e-3);
+        if (!ok && failures++ < 10)
+          std::printf("%s, normal (%g %g %g): weight (%g %g %g), integral "
+                      "(%g %g %g), upright (%g %g %g)\n",
+                      name, normals[k].x(), normals[k].y(), normals[k].z(),
+                      weight.x(), weight.y(), weight.z(), integral.x(),
+                      integral.y(), integral.z(), reference.x(),
+                      reference.y(), reference.z());
+      }
+    }
+
+  std::printf("%s: %d mismatches\n", failures ? "FAILED" : "passed", failures);
+  return failures ? 1 : 0;
+}